@@ -12,7 +12,7 @@
 #include "bus.h"
 #include "pin.h"
 #include "common.h"
-#include "transfer.h"
+#include "output.h"
 
 bool Button__is_pressed(Button *self)
 {
@@ -70,14 +70,14 @@ void Button__handle_normal(Button *self)
     bool pressed = self->is_pressed(self);
     if (pressed && !self->state_primary)
     {
-        wifi_press_multiple(self->actions);
+        output_press_multiple(self->actions);
         self->state_primary = true;
         self->press_timestamp = time_us_64();
         return;
     }
     if ((!pressed) && self->state_primary)
     {
-        wifi_release_multiple(self->actions);
+        output_release_multiple(self->actions);
         self->state_primary = false;
         return;
     }
@@ -92,7 +92,7 @@ void Button__handle_hold(Button *self)
     {
         // Initial press.
         if (immediate)
-            wifi_press_multiple(self->actions);
+            output_press_multiple(self->actions);
         self->state_primary = true;
         self->press_timestamp = time_us_64();
         return;
@@ -102,7 +102,7 @@ void Button__handle_hold(Button *self)
         if (time_us_64() > self->press_timestamp + (time * 1000))
         {
             // Pressed and being held long enough.
-            wifi_press_multiple(self->actions_secondary);
+            output_press_multiple(self->actions_secondary);
             if (!immediate)
                 self->state_primary = false;
             self->state_secondary = true;
@@ -113,13 +113,13 @@ void Button__handle_hold(Button *self)
         if (immediate)
         {
             // Released, immediate actions were triggered.
-            wifi_release_multiple(self->actions);
+            output_release_multiple(self->actions);
         }
         else
         {
             // Released, it was never condidered held.
-            wifi_press_multiple(self->actions);
-            wifi_release_multiple_later(self->actions, 100);
+            output_press_multiple(self->actions);
+            output_release_multiple_later(self->actions, 100);
         }
         self->state_primary = false;
         return;
@@ -127,7 +127,7 @@ void Button__handle_hold(Button *self)
     if (!pressed && self->state_secondary)
     {
         // Relased and it was condidered held.
-        wifi_release_multiple(self->actions_secondary);
+        output_release_multiple(self->actions_secondary);
         self->state_secondary = false;
     }
 }
@@ -155,7 +155,7 @@ void Button__handle_double(Button *self)
         {
             // The press is considered a double press.
             self->state_terciary = true;
-            wifi_press_multiple(self->actions_terciary);
+            output_press_multiple(self->actions_terciary);
         }
         else
         {
@@ -166,7 +166,7 @@ void Button__handle_double(Button *self)
                 if (immediate)
                 {
                     // Trigger primary immediately.
-                    wifi_press_multiple(self->actions);
+                    output_press_multiple(self->actions);
                     self->emitted_primary = true;
                 }
                 else
@@ -175,7 +175,7 @@ void Button__handle_double(Button *self)
                     if (timeout)
                     {
                         // It has been held so long that the next press cannot be a double press.
-                        wifi_press_multiple(self->actions);
+                        output_press_multiple(self->actions);
                         self->emitted_primary = true;
                     }
                 }
@@ -188,7 +188,7 @@ void Button__handle_double(Button *self)
         if (self->emitted_primary)
         {
             // Released and primary actions were triggered.
-            wifi_release_multiple(self->actions);
+            output_release_multiple(self->actions);
             self->state_primary = false;
             self->emitted_primary = false;
         }
@@ -198,8 +198,8 @@ void Button__handle_double(Button *self)
             if (timeout)
             {
                 // Released for so long that the next press cannot be a double press.
-                wifi_press_multiple(self->actions);
-                wifi_release_multiple_later(self->actions, 100);
+                output_press_multiple(self->actions);
+                output_release_multiple_later(self->actions, 100);
                 self->state_primary = false;
             }
         }
@@ -207,7 +207,7 @@ void Button__handle_double(Button *self)
     if (!pressed && self->state_terciary)
     {
         // Released and it was a double press,
-        wifi_release_multiple(self->actions_terciary);
+        output_release_multiple(self->actions_terciary);
         self->state_primary = false;
         self->state_terciary = false;
     }
@@ -237,7 +237,7 @@ void Button__handle_hold_double(Button *self)
         {
             // 触发双击动作.
             self->state_terciary = true;
-            wifi_press_multiple(self->actions_terciary);
+            output_press_multiple(self->actions_terciary);
         }
         else
         {
@@ -247,14 +247,14 @@ void Button__handle_hold_double(Button *self)
                 if (immediate && !self->emitted_primary)
                 {
                     // 触发立即动作.
-                    wifi_press_multiple(self->actions);
+                    output_press_multiple(self->actions);
                     self->emitted_primary = true;
                 }
                 uint64_t timeout = time_us_64() > self->press_timestamp + (hold_time * 1000);
                 if (timeout)
                 {
                     // 触发长按动作.
-                    wifi_press_multiple(self->actions_secondary);
+                    output_press_multiple(self->actions_secondary);
                     self->state_secondary = true;
                 }
             }
@@ -264,7 +264,7 @@ void Button__handle_hold_double(Button *self)
     if (!pressed && self->emitted_primary)
     {
         // Released and primary actions (immediate) was triggered.
-        wifi_release_multiple(self->actions);
+        output_release_multiple(self->actions);
         self->emitted_primary = false;
     }
     if (!pressed && self->state_primary && !self->state_secondary && !self->state_terciary && !immediate)
@@ -273,22 +273,22 @@ void Button__handle_hold_double(Button *self)
         if (timeout)
         {
             // Released for so long that the next press cannot be a double press.
-            wifi_press_multiple(self->actions);
-            wifi_release_multiple_later(self->actions, 100);
+            output_press_multiple(self->actions);
+            output_release_multiple_later(self->actions, 100);
             self->state_primary = false;
         }
     }
     if (!pressed && self->state_secondary)
     {
         // Released and it was considered held.
-        wifi_release_multiple(self->actions_secondary);
+        output_release_multiple(self->actions_secondary);
         self->state_primary = false;
         self->state_secondary = false;
     }
     if (!pressed && self->state_terciary)
     {
         // Released and it was a double press.
-        wifi_release_multiple(self->actions_terciary);
+        output_release_multiple(self->actions_terciary);
         self->state_primary = false;
         self->state_terciary = false;
     }
@@ -300,14 +300,14 @@ void Button__handle_sticky(Button *self)
     if (pressed && !self->state_primary)
     {
         self->state_primary = true;
-        wifi_press_multiple(self->actions);
-        wifi_press_multiple(self->actions_secondary);
+        output_press_multiple(self->actions);
+        output_press_multiple(self->actions_secondary);
         return;
     }
     if ((!pressed) && self->state_primary)
     {
         self->state_primary = false;
-        wifi_release_multiple(self->actions_secondary);
+        output_release_multiple(self->actions_secondary);
         return;
     }
 }
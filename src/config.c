@@ -227,6 +227,21 @@ void config_print()
     info("  long_calibration=%i\n", config_cache.long_calibration);
     info("  swap_gyros=%i\n", config_cache.swap_gyros);
     info("  touch_invert_polarity=%i\n", config_cache.touch_invert_polarity);
+    if (config_cache.wifi_header == NVM_CONTROL_BYTE)
+    {
+        info("  wifi_cache bssid=%02x:%02x:%02x:%02x:%02x:%02x channel=%i ip=%i.%i.%i.%i\n",
+             config_cache.wifi_bssid[0],
+             config_cache.wifi_bssid[1],
+             config_cache.wifi_bssid[2],
+             config_cache.wifi_bssid[3],
+             config_cache.wifi_bssid[4],
+             config_cache.wifi_bssid[5],
+             config_cache.wifi_channel,
+             config_cache.wifi_ip[0],
+             config_cache.wifi_ip[1],
+             config_cache.wifi_ip[2],
+             config_cache.wifi_ip[3]);
+    }
     info("  offset_thumbstick x=%.4f y=%.4f\n",
          config_cache.offset_ts_x,
          config_cache.offset_ts_y);
@@ -628,6 +643,43 @@ void config_set_touch_invert_polarity(bool value)
     touch_load_from_config();
 }
 
+// Remember the association, only written to NVM if it changed.
+void config_set_wifi_cache(
+    const uint8_t *bssid,
+    uint8_t channel,
+    const uint8_t *ip,
+    const uint8_t *gateway,
+    const uint8_t *netmask)
+{
+    if (
+        config_cache.wifi_header == NVM_CONTROL_BYTE &&
+        !memcmp(config_cache.wifi_bssid, bssid, 6) &&
+        config_cache.wifi_channel == channel &&
+        !memcmp(config_cache.wifi_ip, ip, 4) &&
+        !memcmp(config_cache.wifi_gateway, gateway, 4) &&
+        !memcmp(config_cache.wifi_netmask, netmask, 4))
+    {
+        return;
+    }
+    info("Config: wifi_cache channel=%i ip=%i.%i.%i.%i\n", channel, ip[0], ip[1], ip[2], ip[3]);
+    config_cache.wifi_header = NVM_CONTROL_BYTE;
+    memcpy(config_cache.wifi_bssid, bssid, 6);
+    config_cache.wifi_channel = channel;
+    memcpy(config_cache.wifi_ip, ip, 4);
+    memcpy(config_cache.wifi_gateway, gateway, 4);
+    memcpy(config_cache.wifi_netmask, netmask, 4);
+    config_cache_synced = false;
+}
+
+void config_clear_wifi_cache()
+{
+    if (config_cache.wifi_header != NVM_CONTROL_BYTE)
+        return;
+    info("Config: wifi_cache cleared\n");
+    config_cache.wifi_header = 0;
+    config_cache_synced = false;
+}
+
 void config_set_gyro_user_offset(int8_t x, int8_t y, int8_t z)
 {
     float f = 0.01;
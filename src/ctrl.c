@@ -11,6 +11,7 @@
 #include "version.h"
 #include "logging.h"
 #include "transfer.h"
+#include "wifi_sta.h"
 
 Ctrl ctrl_empty()
 {
@@ -58,6 +59,29 @@ Ctrl ctrl_status_share()
     return ctrl;
 }
 
+Ctrl ctrl_wireless_share()
+{
+    Ctrl ctrl = {
+        .protocol_version = CTRL_PROTOCOL_VERSION,
+        .device_id = ALPAKKA,
+        .message_type = WIRELESS_SHARE,
+        .len = sizeof(CtrlWireless)};
+    WifiStats stats = wifi_get_stats();
+    CtrlWireless wireless = {
+        .connected = wifi_is_connected(),
+        .rssi = stats.rssi,
+        .at_latency = stats.at_latency,
+        .tx_bytes = stats.tx_bytes,
+        .frames = stats.frames,
+        .queue = stats.queue,
+        .queue_max = stats.queue_max,
+        .dropped = stats.dropped,
+        .reconnects = stats.reconnects,
+    };
+    memcpy(ctrl.payload, &wireless, sizeof(CtrlWireless));
+    return ctrl;
+}
+
 void ctrl_config_set(Ctrl_cfg_type key, uint8_t preset, uint8_t values[5]) {
     if (key == PROTOCOL) config_set_protocol(preset);
     else if (key == SENS_TOUCH) {
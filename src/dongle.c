@@ -0,0 +1,195 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Entry point of the receiver dongle: a Pico with an ESP8285 that receives the
+frames of the controller and reports them to the host as USB HID, using the
+same HID layer and protocols as the controller itself.
+
+The UART RX IRQ collects the bytes from the ESP, and the loop (at
+CFG_DONGLE_TICK_FREQUENCY) parses them, applies the state and runs
+hid_report(). Sticks and motion go through a jitter buffer (see playout.c), so
+they change evenly from report to report even when frames arrive in bursts.
+
+The age of the reported data (from the last byte received to the HID report)
+is measured, and with the LOG_WIRELESS log mask it is printed every second
+along with the link counters. If no frame arrives for CFG_WIFI_LINK_TIMEOUT
+(the controller sends heartbeats while idle) the link is considered lost and
+everything is released, so no action stays stuck.
+*/
+
+#include <stdio.h>
+#include <pico/stdlib.h>
+#include <tusb.h>
+#include "config.h"
+#include "tusb_config.h"
+#include "hid.h"
+#include "tick.h"
+#include "webusb.h"
+#include "uart.h"
+#include "uart_esp.h"
+#include "wifi_sta.h"
+#include "logging.h"
+#include "common.h"
+
+#if __has_include("version.h")
+#include "version.h"
+#else
+#define VERSION "undefined"
+#endif
+
+typedef struct
+{
+    uint32_t frames;    // Calls that received new state.
+    uint32_t age_sum;   // Microseconds.
+    uint32_t age_max;   // Microseconds.
+    uint32_t reports;   // Ticks that reported new state.
+} DongleStats;
+
+static DongleStats stats = {0};
+static uint32_t received_at = 0;  // Microseconds, last frame completed.
+static bool fresh = false;  // State received but not reported yet.
+static bool link_lost = true;
+
+void title()
+{
+    info("╔====================╗\n");
+    info("║ Input Labs Oy.     ║\n");
+    info("║ Alpakka dongle     ║\n");
+    info("╚====================╝\n");
+    info("Firmware version: %s\n", VERSION);
+}
+
+void dongle_init()
+{
+    stdio_init_all();
+    logging_init();
+    title();
+    config_init();
+    tusb_init();
+    wait_for_usb_init();
+    if (current_protocol_compatible_with_webusb())
+        webusb_set_shut_off(false);
+    hid_init();
+    init_uart();
+    connectToWifi();
+}
+
+// Release everything, as if the controller was idle.
+static void dongle_release()
+{
+    static const transfer_struct released = {.wifi_allow_communication = true};
+    process_received_packet(&released);
+}
+
+static void dongle_receive()
+{
+    if (!wifi_is_connected())
+        return;
+    const transfer_struct *packet = receivePacketOverWiFi();
+    uint32_t now = time_us_32();
+    if (packet)
+    {
+        process_received_packet(packet);
+        received_at = receivePacketTime();
+        fresh = true;
+        stats.frames += 1;
+        if (link_lost)
+        {
+            link_lost = false;
+            info("DONGLE: Link up\n");
+        }
+    }
+    else if (!link_lost && (now - received_at) > (CFG_WIFI_LINK_TIMEOUT * 1000))
+    {
+        link_lost = true;
+        dongle_release();
+        warn("DONGLE: Link lost, no frames for %i ms\n", CFG_WIFI_LINK_TIMEOUT);
+    }
+}
+
+static void dongle_report()
+{
+    hid_report();
+    tick_report_done();
+    if (!fresh)
+        return;
+    // Age of the state when it is handed to the USB stack.
+    uint32_t age = time_us_32() - received_at;
+    stats.age_sum += age;
+    stats.age_max = max(stats.age_max, age);
+    stats.reports += 1;
+    fresh = false;
+}
+
+static void dongle_stats(uint16_t i)
+{
+    if (!logging_has_mask(LOG_WIRELESS) || (i % CFG_DONGLE_TICK_FREQUENCY))
+        return;
+    FrameParserStats parser = receivePacketStats();
+    PlayoutStats playout = receivePlayoutStats();
+    info(
+        "DONGLE: frames=%lu/s age avg=%lu max=%lu us | lost=%lu reordered=%lu crc=%lu\n",
+        (unsigned long)stats.frames,
+        (unsigned long)(stats.reports ? stats.age_sum / stats.reports : 0),
+        (unsigned long)stats.age_max,
+        (unsigned long)parser.lost,
+        (unsigned long)parser.reordered,
+        (unsigned long)parser.crc_errors
+    );
+    info(
+        "DONGLE: playout delay=%lu us | played=%lu late=%lu dropped=%lu extrapolated=%lu\n",
+        (unsigned long)receivePlayoutDelay(),
+        (unsigned long)playout.played,
+        (unsigned long)playout.late,
+        (unsigned long)playout.dropped,
+        (unsigned long)playout.extrapolated
+    );
+    TickStats tick = tick_get_stats();
+    info(
+        "DONGLE: tick phase avg=%.0f max=%lu us | missed=%lu\n",
+        tick.phase_avg,
+        (unsigned long)tick.phase_max,
+        (unsigned long)tick.missed
+    );
+#if CFG_TICK_SOF_SYNC
+    info(
+        "DONGLE: USB frame %s error=%i us slack avg=%.0f max=%lu us\n",
+        tick.sof_locked ? "locked" : "unlocked",
+        tick.sof_error,
+        tick.slack_avg,
+        (unsigned long)tick.slack_max
+    );
+#endif
+    tick_reset_stats();
+    stats = (DongleStats){0};
+}
+
+void dongle_loop()
+{
+    info("INIT: Dongle loop\n");
+    uint16_t i = 0;
+    logging_set_onloop(true);
+    tick_init(CFG_DONGLE_TICK_FREQUENCY);
+    while (true)
+    {
+        i++;
+        // Wait for the deadline of this tick.
+        tick_wait();
+        // Config (the cached Wi-Fi association).
+        config_sync();
+        // Wireless link bring-up.
+        wifi_sta_task();
+        // Frames to HID.
+        dongle_receive();
+        dongle_report();
+        dongle_stats(i);
+        uart_listen_char(i);
+    }
+}
+
+int main()
+{
+    dongle_init();
+    dongle_loop();
+}
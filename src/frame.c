@@ -0,0 +1,558 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Frames are the unit of state sent from the controller to the receiver over the
+ESP8285 link. A frame is a header followed by optional sections, the presence
+of each section is determined by the flags in the header:
+
+| Header (6) | Digital (1~33)? | Axes (12)? | Mouse (5)? | Gyro (6)? |
+| Accel (6)? | History (12)? | Sync (12)? | Motion (1~43)? |
+
+The digital section carries the active actions (any of the 256 action codes),
+sparse: usually only a few actions are active, so it is sent as a list of codes
+(count and codes), and only when more than 31 are active as the whole bitmap.
+The axes section carries the axes already resolved and quantized, so the
+receiver does not need to know about axis actions nor the profile.
+
+Digital, axes, gyro and accel are absolute: when a section is missing the
+receiver keeps the last value received. Mouse is relative: when missing there
+is no movement.
+
+The history section repeats the last digital transitions (with their own
+sequence number), so a quick tap whose press and release frames were both lost
+can still be reconstructed by the receiver from any later frame.
+
+The motion section batches the IMU samples taken since the last frame (up to
+FRAME_MOTION_LEN, each with its age relative to the frame time), so the
+receiver gets every sample while the frame rate stays below the IMU rate. The
+gyro and accel sections only carry the latest value.
+
+The sync section is link control, not state: the receiver sends it to the
+controller, which answers with its own clock, so the receiver can map the
+capture time in the header to its own clock and measure one-way latency.
+
+On byte streams frames are wrapped in an envelope with a sync word, length,
+sequence number and CRC16 (CCITT, over length, sequence and frame). The parser
+is fed one byte at a time, drops anything that does not check out and looks for
+the next sync word, so lost or corrupted bytes only cost the affected frame.
+
+All multi-byte values are little-endian (native for both RP2040 and x86).
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include "frame.h"
+
+// Sections with a variable size on the wire have their own encoder (returns
+// the bytes written, or only counts them if the buffer is NULL) and decoder
+// (returns the bytes consumed, zero if invalid), the rest are copied as is.
+typedef struct
+{
+    uint8_t flag;
+    uint8_t offset;
+    uint8_t size;
+    uint8_t (*encode)(uint8_t *buffer, const void *section);
+    uint8_t (*decode)(const uint8_t *buffer, uint8_t len, void *section);
+} FrameSection;
+
+static uint8_t frame_digital_encode(uint8_t *buffer, const void *section);
+static uint8_t frame_digital_decode(const uint8_t *buffer, uint8_t len, void *section);
+static uint8_t frame_motion_encode(uint8_t *buffer, const void *section);
+static uint8_t frame_motion_decode(const uint8_t *buffer, uint8_t len, void *section);
+
+static const FrameSection sections[] = {
+    {
+        FRAME_FLAG_DIGITAL,
+        offsetof(Frame, digital),
+        sizeof(FrameDigital),
+        frame_digital_encode,
+        frame_digital_decode,
+    },
+    {FRAME_FLAG_AXES, offsetof(Frame, axes), sizeof(FrameAxes), NULL, NULL},
+    {FRAME_FLAG_MOUSE, offsetof(Frame, mouse), sizeof(FrameMouse), NULL, NULL},
+    {FRAME_FLAG_GYRO, offsetof(Frame, gyro), sizeof(FrameVector), NULL, NULL},
+    {FRAME_FLAG_ACCEL, offsetof(Frame, accel), sizeof(FrameVector), NULL, NULL},
+    {FRAME_FLAG_HISTORY, offsetof(Frame, history), sizeof(FrameHistory), NULL, NULL},
+    {FRAME_FLAG_SYNC, offsetof(Frame, sync), sizeof(FrameSync), NULL, NULL},
+    {
+        FRAME_FLAG_MOTION,
+        offsetof(Frame, motion),
+        sizeof(FrameMotion),
+        frame_motion_encode,
+        frame_motion_decode,
+    },
+};
+
+#define FRAME_SECTIONS_LEN (sizeof(sections) / sizeof(FrameSection))
+
+void frame_action_set(FrameDigital *digital, uint8_t action, bool active)
+{
+    uint8_t mask = 1 << (action % 8);
+    if (active)
+        digital->actions[action / 8] |= mask;
+    else
+        digital->actions[action / 8] &= ~mask;
+}
+
+bool frame_action_get(const FrameDigital *digital, uint8_t action)
+{
+    return (digital->actions[action / 8] >> (action % 8)) & 1;
+}
+
+// Count and active codes if that is smaller, otherwise the marker and bitmap.
+static uint8_t frame_digital_encode(uint8_t *buffer, const void *section)
+{
+    const FrameDigital *digital = section;
+    uint16_t count = 0;
+    for (uint8_t i = 0; i < sizeof(FrameDigital); i++)
+        count += __builtin_popcount(digital->actions[i]);
+    if (count >= sizeof(FrameDigital))
+    {
+        if (buffer)
+        {
+            buffer[0] = FRAME_DIGITAL_BITMAP;
+            memcpy(buffer + 1, digital->actions, sizeof(FrameDigital));
+        }
+        return 1 + sizeof(FrameDigital);
+    }
+    if (buffer)
+    {
+        uint8_t len = 0;
+        buffer[len++] = count;
+        for (uint8_t i = 0; i < sizeof(FrameDigital); i++)
+        {
+            uint8_t bits = digital->actions[i];
+            while (bits)
+            {
+                uint8_t bit = __builtin_ctz(bits);
+                buffer[len++] = (i * 8) + bit;
+                bits &= bits - 1;
+            }
+        }
+    }
+    return 1 + count;
+}
+
+static uint8_t frame_digital_decode(const uint8_t *buffer, uint8_t len, void *section)
+{
+    FrameDigital *digital = section;
+    if (len < 1)
+        return 0;
+    if (buffer[0] == FRAME_DIGITAL_BITMAP)
+    {
+        if (len < 1 + sizeof(FrameDigital))
+            return 0;
+        memcpy(digital->actions, buffer + 1, sizeof(FrameDigital));
+        return 1 + sizeof(FrameDigital);
+    }
+    uint8_t count = buffer[0];
+    if (count >= sizeof(FrameDigital) || len < 1 + count)
+        return 0;
+    for (uint8_t i = 0; i < count; i++)
+        frame_action_set(digital, buffer[1 + i], true);
+    return 1 + count;
+}
+
+// Count and the used samples.
+static uint8_t frame_motion_encode(uint8_t *buffer, const void *section)
+{
+    const FrameMotion *motion = section;
+    uint8_t len = motion->len < FRAME_MOTION_LEN ? motion->len : FRAME_MOTION_LEN;
+    uint8_t size = len * sizeof(FrameMotionSample);
+    if (buffer)
+    {
+        buffer[0] = len;
+        memcpy(buffer + 1, motion->samples, size);
+    }
+    return 1 + size;
+}
+
+static uint8_t frame_motion_decode(const uint8_t *buffer, uint8_t len, void *section)
+{
+    FrameMotion *motion = section;
+    if (len < 1 || buffer[0] > FRAME_MOTION_LEN)
+        return 0;
+    uint8_t size = buffer[0] * sizeof(FrameMotionSample);
+    if (len < 1 + size)
+        return 0;
+    motion->len = buffer[0];
+    memcpy(motion->samples, buffer + 1, size);
+    return 1 + size;
+}
+
+// Size of the encoded frame, without the envelope.
+uint8_t frame_size(const Frame *frame)
+{
+    uint8_t flags = frame->header.flags;
+    uint8_t size = sizeof(FrameHeader);
+    for (uint8_t i = 0; i < FRAME_SECTIONS_LEN; i++)
+    {
+        if (!(flags & sections[i].flag))
+            continue;
+        if (sections[i].encode)
+            size += sections[i].encode(NULL, (uint8_t *)frame + sections[i].offset);
+        else
+            size += sections[i].size;
+    }
+    return size;
+}
+
+int16_t frame_quantize(double value, double scale)
+{
+    double scaled = value * scale;
+    if (scaled > 32767)
+        return 32767;
+    if (scaled < -32767)
+        return -32767;
+    return (int16_t)scaled;
+}
+
+// Write the frame into the buffer (at least FRAME_MAX_SIZE long).
+// Returns the number of bytes written.
+uint8_t frame_encode(uint8_t *buffer, const Frame *frame)
+{
+    uint8_t flags = frame->header.flags;
+    memcpy(buffer, &frame->header, sizeof(FrameHeader));
+    buffer[0] = FRAME_VERSION;
+    uint8_t offset = sizeof(FrameHeader);
+    for (uint8_t i = 0; i < FRAME_SECTIONS_LEN; i++)
+    {
+        if (!(flags & sections[i].flag))
+            continue;
+        const uint8_t *section = (uint8_t *)frame + sections[i].offset;
+        if (sections[i].encode)
+        {
+            offset += sections[i].encode(buffer + offset, section);
+            continue;
+        }
+        memcpy(buffer + offset, section, sections[i].size);
+        offset += sections[i].size;
+    }
+    return offset;
+}
+
+// Parse a frame from the buffer. Returns false if the frame version is not
+// supported or the length does not match the flags.
+bool frame_decode(const uint8_t *buffer, uint8_t len, Frame *frame)
+{
+    memset(frame, 0, sizeof(Frame));
+    if (len < sizeof(FrameHeader))
+        return false;
+    if (buffer[0] != FRAME_VERSION)
+        return false;
+    memcpy(&frame->header, buffer, sizeof(FrameHeader));
+    // Every flag bit is a known section, the length check below catches the rest.
+    uint8_t flags = frame->header.flags;
+    uint8_t offset = sizeof(FrameHeader);
+    for (uint8_t i = 0; i < FRAME_SECTIONS_LEN; i++)
+    {
+        if (!(flags & sections[i].flag))
+            continue;
+        uint8_t *section = (uint8_t *)frame + sections[i].offset;
+        if (sections[i].decode)
+        {
+            uint8_t consumed = sections[i].decode(buffer + offset, len - offset, section);
+            if (!consumed)
+                return false;
+            offset += consumed;
+            continue;
+        }
+        if (len - offset < sections[i].size)
+            return false;
+        memcpy(section, buffer + offset, sections[i].size);
+        offset += sections[i].size;
+    }
+    return offset == len;
+}
+
+// Flags of the sections of the current frame that need to be sent, given the
+// previous frame the receiver already has.
+uint8_t frame_changes(const Frame *previous, const Frame *current)
+{
+    static const FrameMouse still = {0};
+    uint8_t flags = 0;
+    if (memcmp(&previous->digital, &current->digital, sizeof(FrameDigital)))
+        flags |= FRAME_FLAG_DIGITAL;
+    if (memcmp(&previous->axes, &current->axes, sizeof(FrameAxes)))
+        flags |= FRAME_FLAG_AXES;
+    if (memcmp(&still, &current->mouse, sizeof(FrameMouse)))
+        flags |= FRAME_FLAG_MOUSE;
+    if (memcmp(&previous->gyro, &current->gyro, sizeof(FrameVector)))
+        flags |= FRAME_FLAG_GYRO;
+    if (memcmp(&previous->accel, &current->accel, sizeof(FrameVector)))
+        flags |= FRAME_FLAG_ACCEL;
+    if (memcmp(&previous->history, &current->history, sizeof(FrameHistory)))
+        flags |= FRAME_FLAG_HISTORY;
+    return flags;
+}
+
+// Apply a decoded frame on top of the receiver state.
+void frame_merge(Frame *state, const Frame *update)
+{
+    uint8_t flags = update->header.flags;
+    for (uint8_t i = 0; i < FRAME_SECTIONS_LEN; i++)
+    {
+        if (!(flags & sections[i].flag))
+            continue;
+        memcpy((uint8_t *)state + sections[i].offset, (uint8_t *)update + sections[i].offset, sections[i].size);
+    }
+    if (!(flags & FRAME_FLAG_MOUSE))
+        memset(&state->mouse, 0, sizeof(FrameMouse));
+    state->header.version = update->header.version;
+    state->header.flags |= flags;
+    state->header.time = update->header.time;
+}
+
+// Transitions in the history newer than the last one seen by the receiver
+// (sequence), oldest first. Updates the receiver sequence. The first history
+// received only sets the sequence, older transitions are not replayed (an empty
+// history leaves it at zero, the sender numbers transitions from 1).
+// Returns how many were written into transitions (FRAME_HISTORY_LEN long).
+uint8_t frame_history_new(
+    const FrameHistory *history,
+    bool *has_sequence,
+    uint8_t *sequence,
+    FrameTransition *transitions)
+{
+    uint8_t len = 0;
+    for (uint8_t i = 0; i < FRAME_HISTORY_LEN; i++)
+    {
+        const FrameTransition *transition = &history->transitions[i];
+        if (!transition->action)
+            continue;
+        if (*has_sequence && (int8_t)(transition->sequence - *sequence) <= 0)
+            continue;
+        if (*has_sequence)
+            transitions[len++] = *transition;
+        *sequence = transition->sequence;
+    }
+    *has_sequence = true;
+    return len;
+}
+
+uint16_t frame_crc16(const uint8_t *data, uint16_t len)
+{
+    uint16_t crc = 0xFFFF;
+    for (uint16_t i = 0; i < len; i++)
+    {
+        crc ^= data[i] << 8;
+        for (uint8_t bit = 0; bit < 8; bit++)
+        {
+            if (crc & 0x8000)
+                crc = (crc << 1) ^ 0x1021;
+            else
+                crc = crc << 1;
+        }
+    }
+    return crc;
+}
+
+// Write the frame wrapped in the envelope into the buffer (at least
+// FRAME_PACKED_MAX_SIZE long). Returns the number of bytes written.
+uint8_t frame_pack(uint8_t *buffer, uint16_t sequence, const Frame *frame)
+{
+    uint8_t len = frame_encode(buffer + FRAME_ENVELOPE_HEADER_SIZE, frame);
+    buffer[0] = FRAME_SYNC_0;
+    buffer[1] = FRAME_SYNC_1;
+    buffer[2] = len;
+    buffer[3] = sequence & 0xFF;
+    buffer[4] = sequence >> 8;
+    uint16_t crc = frame_crc16(buffer + 2, len + 3);
+    buffer[FRAME_ENVELOPE_HEADER_SIZE + len] = crc & 0xFF;
+    buffer[FRAME_ENVELOPE_HEADER_SIZE + len + 1] = crc >> 8;
+    return len + FRAME_ENVELOPE_SIZE;
+}
+
+void frame_parser_init(FrameParser *parser)
+{
+    memset(parser, 0, sizeof(FrameParser));
+    parser->state = FRAME_PARSER_SYNC_0;
+}
+
+// The envelope in the buffer was rejected. If a byte was lost, the next sync
+// word may already be inside it, so the bytes from the next sync word on are
+// parsed again instead of being discarded.
+static void frame_parser_rescan(FrameParser *parser)
+{
+    uint8_t start = parser->index;
+    for (uint8_t i = 1; i < parser->index; i++)
+    {
+        bool last = (i + 1) == parser->index;
+        if (parser->buffer[i] == FRAME_SYNC_0 && (last || parser->buffer[i + 1] == FRAME_SYNC_1))
+        {
+            start = i;
+            break;
+        }
+    }
+    // Before the bytes still pending from a previous rescan.
+    uint8_t len = parser->index - start;
+    uint8_t unread = parser->pending_len - parser->pending_index;
+    memmove(parser->pending + len, parser->pending + parser->pending_index, unread);
+    memcpy(parser->pending, parser->buffer + start, len);
+    parser->pending_index = 0;
+    parser->pending_len = len + unread;
+    parser->index = 0;
+    parser->state = FRAME_PARSER_SYNC_0;
+}
+
+static bool frame_parser_accept(FrameParser *parser, Frame *frame)
+{
+    uint8_t *buffer = parser->buffer;
+    uint8_t len = buffer[2];
+    uint8_t *crc_bytes = buffer + FRAME_ENVELOPE_HEADER_SIZE + len;
+    uint16_t crc = crc_bytes[0] | (crc_bytes[1] << 8);
+    if (crc != frame_crc16(buffer + 2, len + 3))
+    {
+        parser->stats.crc_errors += 1;
+        frame_parser_rescan(parser);
+        return false;
+    }
+    if (!frame_decode(buffer + FRAME_ENVELOPE_HEADER_SIZE, len, frame))
+    {
+        parser->stats.format_errors += 1;
+        frame_parser_rescan(parser);
+        return false;
+    }
+    uint16_t sequence = buffer[3] | (buffer[4] << 8);
+    if (parser->has_sequence)
+    {
+        int16_t delta = (int16_t)(sequence - parser->sequence);
+        if (delta <= 0 && delta > -FRAME_REORDER_WINDOW)
+        {
+            parser->stats.reordered += 1;
+            return false;
+        }
+        if (delta > 0)
+            parser->stats.lost += delta - 1;
+    }
+    parser->has_sequence = true;
+    parser->sequence = sequence;
+    parser->stats.frames += 1;
+    return true;
+}
+
+static bool frame_parser_step(FrameParser *parser, uint8_t byte, Frame *frame)
+{
+    switch (parser->state)
+    {
+        case FRAME_PARSER_SYNC_0:
+            if (byte == FRAME_SYNC_0)
+                parser->state = FRAME_PARSER_SYNC_1;
+            else
+                parser->stats.skipped += 1;
+            return false;
+        case FRAME_PARSER_SYNC_1:
+            if (byte == FRAME_SYNC_1)
+            {
+                parser->buffer[0] = FRAME_SYNC_0;
+                parser->buffer[1] = FRAME_SYNC_1;
+                parser->index = 2;
+                parser->state = FRAME_PARSER_LENGTH;
+            }
+            else if (byte == FRAME_SYNC_0)
+            {
+                parser->stats.skipped += 1;
+            }
+            else
+            {
+                parser->stats.skipped += 2;
+                parser->state = FRAME_PARSER_SYNC_0;
+            }
+            return false;
+        case FRAME_PARSER_LENGTH:
+            if (byte < sizeof(FrameHeader) || byte > FRAME_MAX_SIZE)
+            {
+                parser->stats.format_errors += 1;
+                parser->buffer[parser->index++] = byte;
+                frame_parser_rescan(parser);
+                return false;
+            }
+            parser->buffer[parser->index++] = byte;
+            parser->expected = byte + FRAME_ENVELOPE_SIZE;
+            parser->state = FRAME_PARSER_BODY;
+            return false;
+        case FRAME_PARSER_BODY:
+            parser->buffer[parser->index++] = byte;
+            if (parser->index < parser->expected)
+                return false;
+            parser->state = FRAME_PARSER_SYNC_0;
+            return frame_parser_accept(parser, frame);
+    }
+    return false;
+}
+
+// Feed one byte from the stream. Returns true when a valid frame was completed,
+// in which case it is decoded into frame.
+bool frame_parser_feed(FrameParser *parser, uint8_t byte, Frame *frame)
+{
+    if (parser->pending_index < parser->pending_len)
+    {
+        // Queued behind the bytes to parse again.
+        if (parser->pending_len < sizeof(parser->pending))
+            parser->pending[parser->pending_len++] = byte;
+        else
+            parser->stats.skipped += 1;
+    }
+    else if (frame_parser_step(parser, byte, frame))
+    {
+        return true;
+    }
+    bool completed = false;
+    while (!completed && parser->pending_index < parser->pending_len)
+    {
+        uint8_t next = parser->pending[parser->pending_index++];
+        completed = frame_parser_step(parser, next, frame);
+    }
+    if (parser->pending_index == parser->pending_len)
+    {
+        parser->pending_index = 0;
+        parser->pending_len = 0;
+    }
+    return completed;
+}
+
+// Add a clock sync exchange, arrival is the receiver time when the answer
+// arrived. Uses the fastest of the last exchanges (the least queueing) right
+// away, and estimates the drift between the fastest ones at least a second
+// apart.
+void frame_clock_sample(FrameClock *clock, const FrameSync *sync, uint32_t arrival)
+{
+    FrameClockSample sample;
+    uint32_t forward = sync->received - sync->request;
+    uint32_t backward = sync->sent - arrival;
+    sample.local = arrival;
+    sample.rtt = (arrival - sync->request) - (sync->sent - sync->received);
+    sample.offset = forward - ((int32_t)(forward - backward) / 2);
+    clock->samples[clock->head] = sample;
+    clock->head = (clock->head + 1) % FRAME_CLOCK_SAMPLES;
+    if (clock->count < FRAME_CLOCK_SAMPLES)
+        clock->count += 1;
+    FrameClockSample best = clock->samples[0];
+    for (uint8_t i = 1; i < clock->count; i++)
+    {
+        if (clock->samples[i].rtt < best.rtt)
+            best = clock->samples[i];
+    }
+    clock->best = best;
+    if (!clock->synced)
+    {
+        clock->anchor = best;
+        clock->synced = true;
+        return;
+    }
+    int32_t span = best.local - clock->anchor.local;
+    if (span < FRAME_CLOCK_DRIFT_MIN_SPAN)
+        return;
+    double drift = (int32_t)(best.offset - clock->anchor.offset) / (double)span;
+    clock->drift += (drift - clock->drift) / 4;
+    clock->anchor = best;
+}
+
+// Convert a controller time into receiver time.
+uint32_t frame_clock_to_local(const FrameClock *clock, uint32_t remote)
+{
+    uint32_t local = remote - clock->best.offset;
+    int32_t elapsed = local - clock->best.local;
+    return local - (int32_t)(clock->drift * elapsed);
+}
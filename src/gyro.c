@@ -15,11 +15,11 @@
 #include "pin.h"
 #include "touch.h"
 #include "vector.h"
-#include "transfer.h"
+#include "output.h"
 
 double sensitivity_multiplier;
 
-uint8_t world_init = 0;
+uint16_t world_init = 0;
 Vector world_top;
 Vector world_fw;
 Vector world_right;
@@ -67,45 +67,45 @@ void gyro_absolute_output(float value, uint8_t *actions, bool *pressed)
     for (uint8_t i = 0; i < 4; i++)
     {
         uint8_t action = actions[i];
-        if (wifi_is_axis(action))
+        if (output_is_axis(action))
         {
             value = fabs(value);
             if (action == GAMEPAD_AXIS_LX)
-                wifi_gamepad_lx(value);
+                output_gamepad_lx(value);
             else if (action == GAMEPAD_AXIS_LY)
-                wifi_gamepad_ly(value);
+                output_gamepad_ly(value);
             else if (action == GAMEPAD_AXIS_LZ)
-                wifi_gamepad_lz(value);
+                output_gamepad_lz(value);
             else if (action == GAMEPAD_AXIS_RX)
-                wifi_gamepad_rx(value);
+                output_gamepad_rx(value);
             else if (action == GAMEPAD_AXIS_RY)
-                wifi_gamepad_ry(value);
+                output_gamepad_ry(value);
             else if (action == GAMEPAD_AXIS_RZ)
-                wifi_gamepad_rz(value);
+                output_gamepad_rz(value);
             else if (action == GAMEPAD_AXIS_LX_NEG)
-                wifi_gamepad_lx(-value);
+                output_gamepad_lx(-value);
             else if (action == GAMEPAD_AXIS_LY_NEG)
-                wifi_gamepad_ly(-value);
+                output_gamepad_ly(-value);
             else if (action == GAMEPAD_AXIS_LZ_NEG)
-                wifi_gamepad_lz(-value);
+                output_gamepad_lz(-value);
             else if (action == GAMEPAD_AXIS_RX_NEG)
-                wifi_gamepad_rx(-value);
+                output_gamepad_rx(-value);
             else if (action == GAMEPAD_AXIS_RY_NEG)
-                wifi_gamepad_ry(-value);
+                output_gamepad_ry(-value);
             else if (action == GAMEPAD_AXIS_RZ_NEG)
-                wifi_gamepad_rz(-value);
+                output_gamepad_rz(-value);
         }
         else
         {
             if (!(*pressed) && value >= 0.5)
             {
-                wifi_press(action);
+                output_press(action);
                 if (i == 3)
                     *pressed = true;
             }
             else if (*pressed && value < 0.5)
             {
-                wifi_release(action);
+                output_release(action);
                 if (i == 3)
                     *pressed = false;
             }
@@ -119,13 +119,13 @@ void gyro_incremental_output(double value, uint8_t *actions)
     {
         uint8_t action = actions[i];
         if (action == MOUSE_X)
-            wifi_mouse_move(value, 0);
+            output_mouse_move(value, 0);
         else if (action == MOUSE_Y)
-            wifi_mouse_move(0, value);
+            output_mouse_move(0, value);
         else if (action == MOUSE_X_NEG)
-            wifi_mouse_move(-value, 0);
+            output_mouse_move(-value, 0);
         else if (action == MOUSE_Y_NEG)
-            wifi_mouse_move(0, -value);
+            output_mouse_move(0, -value);
     }
 }
 
@@ -144,7 +144,7 @@ void Gyro__report_absolute(Gyro *self)
     gyro_accel_correction();
     // Get data from gyros.
     Vector gyro = imu_read_gyro();
-    static float sens = -BIT_18 * M_PI;
+    static float sens = -BIT_18 * M_PI / CFG_TICK_SCALE; // Rotation per tick.
     // Rotate world space orientation.
     Vector4 rx = quaternion(world_right, gyro.y / sens);
     Vector4 ry = quaternion(world_fw, gyro.z / sens);
@@ -173,10 +173,10 @@ void Gyro__report_absolute(Gyro *self)
     bool debug = 0;
     if (debug)
     {
-        wifi_gamepad_lx(world_top.x);
-        wifi_gamepad_ly(-world_top.y);
-        wifi_gamepad_rx(world_fw.x);
-        wifi_gamepad_ry(-world_fw.y);
+        output_gamepad_lx(world_top.x);
+        output_gamepad_ly(-world_top.y);
+        output_gamepad_rx(world_fw.x);
+        output_gamepad_ry(-world_fw.y);
         return;
     }
     // Output calculation.
@@ -277,11 +277,12 @@ void Gyro__report_incremental(Gyro *self)
     static double sub_z = 0;
     // Read gyro values.
     Vector imu_gyro = imu_read_gyro();
-    double x = imu_gyro.x * CFG_GYRO_SENSITIVITY_X * sensitivity_multiplier;
-    double y = imu_gyro.y * CFG_GYRO_SENSITIVITY_Y * sensitivity_multiplier;
-    double z = imu_gyro.z * CFG_GYRO_SENSITIVITY_Z * sensitivity_multiplier;
+    // Motion per tick.
+    double x = imu_gyro.x * CFG_GYRO_SENSITIVITY_X * sensitivity_multiplier * CFG_TICK_SCALE;
+    double y = imu_gyro.y * CFG_GYRO_SENSITIVITY_Y * sensitivity_multiplier * CFG_TICK_SCALE;
+    double z = imu_gyro.z * CFG_GYRO_SENSITIVITY_Z * sensitivity_multiplier * CFG_TICK_SCALE;
     // Additional processing.
-    double t = 1.0;
+    double t = 1.0 * CFG_TICK_SCALE;
     double k = 0.5;
     if (x > 0 && x < t)
         x = hssnf(t, k, x);
@@ -324,14 +325,16 @@ void report_gyro_and_accel(Gyro *self)
 {
     Vector imu_gyro = imu_read_gyro();
     static Vector imu_gyro_smooth = {0};
-    imu_gyro_smooth = vector_smooth(imu_gyro_smooth, imu_gyro, 10);
+    imu_gyro_smooth = vector_smooth(imu_gyro_smooth, imu_gyro, 10 / CFG_TICK_SCALE);
 
     Vector imu_accel = imu_read_accel();
     static Vector imu_accel_smooth = {0};
-    imu_accel_smooth = vector_smooth(imu_accel_smooth, imu_accel, 50);
+    imu_accel_smooth = vector_smooth(imu_accel_smooth, imu_accel, 50 / CFG_TICK_SCALE);
 
-    wifi_gamepad_gyro(imu_gyro_smooth.x, imu_gyro_smooth.y, imu_gyro_smooth.z);
-    wifi_gamepad_accel(imu_accel_smooth.x, imu_accel_smooth.y, imu_accel_smooth.z);
+    output_gamepad_gyro(imu_gyro_smooth.x, imu_gyro_smooth.y, imu_gyro_smooth.z);
+    output_gamepad_accel(imu_accel_smooth.x, imu_accel_smooth.y, imu_accel_smooth.z);
+    // The motion stream carries the raw samples, every tick.
+    output_gamepad_motion(imu_gyro, imu_accel);
 }
 
 bool Gyro__is_engaged(Gyro *self)
@@ -27,10 +27,18 @@
 
 #define CFG_LED_BRIGHTNESS 0.2
 
-#define CFG_TICK_FREQUENCY 250 // Hz.
+#define CFG_TICK_FREQUENCY 250 // Hz, 250 or 1000 (1 ms USB polling).
 #define CFG_TICK_INTERVAL (1000 / CFG_TICK_FREQUENCY)
-#define CFG_IMU_TICK_SAMPLES 128 // Multi-sampling per pooling cycle.
-#define CFG_HID_REPORT_PRIORITY_RATIO 8
+#define CFG_TICK_SCALE (250.0 / CFG_TICK_FREQUENCY) // Per-tick values are tuned at 250 Hz.
+#define CFG_IMU_TICK_SAMPLES (128 * 250 / CFG_TICK_FREQUENCY) // Multi-sampling per pooling cycle.
+#define CFG_IMU_TICK_SAMPLES_MIN 8
+#define CFG_TICK_SOF_SYNC 1 // Phase-lock the ticks to the USB frames.
+#define CFG_TICK_SOF_GUARD 100 // Microseconds, reports ready before the frame starts.
+
+// Time budget of each stage of the tick, in percent of the tick interval.
+#define CFG_TICK_BUDGET_SAMPLING 50 // IMU multi-sampling.
+#define CFG_TICK_BUDGET_PROFILE 20  // profile_report_active() besides sampling.
+#define CFG_TICK_BUDGET_REPORT 20   // wifi_report() and hid_report().
 
 #define NVM_SYNC_FREQUENCY (CFG_TICK_FREQUENCY / 2)
 
@@ -44,8 +52,8 @@
 #define CFG_GYRO_SENSITIVITY_Y CFG_GYRO_SENSITIVITY * 1
 #define CFG_GYRO_SENSITIVITY_Z CFG_GYRO_SENSITIVITY * 1
 #define CFG_MOUSE_WHEEL_DEBOUNCE 1000
-#define CFG_ACCEL_CORRECTION_SMOOTH 50   // Number of averaged samples for the correction vector.
-#define CFG_ACCEL_CORRECTION_RATE 0.0007 // How fast the correction is applied.
+#define CFG_ACCEL_CORRECTION_SMOOTH (50 / CFG_TICK_SCALE)     // Number of averaged samples for the correction vector.
+#define CFG_ACCEL_CORRECTION_RATE (0.0007 * CFG_TICK_SCALE) // How fast the correction is applied.
 
 #define CFG_PRESS_DEBOUNCE 50     // Milliseconds.
 #define CFG_HOLD_TIME 200         // Milliseconds.
@@ -58,6 +66,27 @@
 
 #define CFG_DHAT_DEBOUNCE_TIME 100 // Milliseconds.
 
+#define CFG_WIFI_RETRY_DELAY 2000 // Milliseconds.
+#define CFG_WIFI_TRANSPORT WIFI_TRANSPORT_TCP
+#define CFG_WIFI_UART_BAUDRATE 921600 // Negotiated with the ESP, up to 2000000.
+#define CFG_WIFI_UART_FLOW_CONTROL 0 // RTS/CTS on GPIO2/GPIO3, not on boards with the LEDs on them.
+#define CFG_WIFI_HEARTBEAT_INTERVAL 100 // Milliseconds, frame rate while idle.
+#define CFG_WIFI_BACKLOG_LIMIT 128 // Bytes waiting in the TX ring before motion is held back.
+#define CFG_WIFI_LINK_TIMEOUT 500 // Milliseconds without frames before the dongle releases everything.
+#define CFG_WIFI_STALL_TIMEOUT 1000 // Milliseconds the TX ring can stay backlogged before the link is lost.
+#define CFG_WIFI_SYNC_TIMEOUT 5000 // Milliseconds without sync requests (once seen) before the link is lost.
+#define CFG_WIFI_TELEMETRY_INTERVAL 5000 // Milliseconds between RSSI queries (dongle only).
+#define CFG_DONGLE_TICK_FREQUENCY 1000 // Hz.
+#define CFG_OUTPUT_SINK OUTPUT_SINK_WIRELESS
+
+#define WIFI_TRANSPORT_TCP 0
+#define WIFI_TRANSPORT_UDP 1 // Lower latency, frames may be lost.
+
+// Where the input pipeline reports, see output.h.
+#define OUTPUT_SINK_USB 0b01
+#define OUTPUT_SINK_WIRELESS 0b10
+#define OUTPUT_SINK_MIRROR (OUTPUT_SINK_USB | OUTPUT_SINK_WIRELESS)
+
 typedef struct __packed _Config
 {
     uint8_t header;
@@ -95,6 +124,13 @@ typedef struct __packed _Config
     bool long_calibration;
     bool swap_gyros;
     bool touch_invert_polarity;
+    // Last good Wi-Fi association, for the fast reconnect.
+    uint8_t wifi_header; // NVM_CONTROL_BYTE when the values below are valid.
+    uint8_t wifi_bssid[6];
+    uint8_t wifi_channel;
+    uint8_t wifi_ip[4];
+    uint8_t wifi_gateway[4];
+    uint8_t wifi_netmask[4];
     uint8_t padding[256]; // Guarantee block is at least 256 bytes or more.
 } Config;
 
@@ -145,6 +181,14 @@ void config_set_long_calibration(bool value);
 void config_set_swap_gyros(bool value);
 void config_set_touch_invert_polarity(bool value);
 void config_set_gyro_user_offset(int8_t x, int8_t y, int8_t z);
+void config_set_wifi_cache(
+    const uint8_t *bssid,
+    uint8_t channel,
+    const uint8_t *ip,
+    const uint8_t *gateway,
+    const uint8_t *netmask
+);
+void config_clear_wifi_cache();
 
 // Profiles.
 uint8_t config_get_profile();
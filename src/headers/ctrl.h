@@ -29,6 +29,8 @@ typedef enum Ctrl_msg_type_enum
     STATUS_SET,
     STATUS_SHARE,
     PROFILE_OVERWRITE,
+    WIRELESS_GET,
+    WIRELESS_SHARE,
 } Ctrl_msg_type;
 
 typedef enum Ctrl_cfg_type_enum
@@ -217,6 +219,20 @@ typedef struct __packed _CtrlMacro
     uint8_t _padding[2];
 } CtrlMacro;
 
+typedef struct __packed _CtrlWireless
+{
+    // Must be packed (20 bytes).
+    uint8_t connected;
+    int8_t rssi;          // dBm, zero if unknown.
+    uint16_t at_latency;  // Milliseconds.
+    uint32_t tx_bytes;    // Per second.
+    uint16_t frames;      // Per second.
+    uint16_t queue;       // Bytes.
+    uint16_t queue_max;   // Bytes.
+    uint32_t dropped;
+    uint16_t reconnects;
+} CtrlWireless;
+
 typedef union _CtrlSection
 {
     CtrlProfileMeta meta;
@@ -238,6 +254,7 @@ typedef struct _CtrlProfile
 Ctrl ctrl_empty();
 Ctrl ctrl_log(uint8_t *offset_ptr, uint8_t len);
 Ctrl ctrl_status_share();
+Ctrl ctrl_wireless_share();
 Ctrl ctrl_config_share(uint8_t index);
 Ctrl ctrl_section_share(uint8_t profile_index, uint8_t section_index);
 
@@ -0,0 +1,234 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Wire format shared by the controller, the receiver and the host tools.
+// Must not depend on the Pico SDK.
+
+#define FRAME_VERSION 7
+
+// Sections present in the frame, in wire order.
+#define FRAME_FLAG_DIGITAL 0b00000001
+#define FRAME_FLAG_AXES 0b00000010
+#define FRAME_FLAG_MOUSE 0b00000100
+#define FRAME_FLAG_GYRO 0b00001000
+#define FRAME_FLAG_ACCEL 0b00010000
+#define FRAME_FLAG_HISTORY 0b00100000
+#define FRAME_FLAG_SYNC 0b01000000
+#define FRAME_FLAG_MOTION 0b10000000
+// Sections that describe the whole state (the rest are relative or samples).
+#define FRAME_FLAGS_ABSOLUTE (FRAME_FLAG_DIGITAL | FRAME_FLAG_AXES)
+// Sections that carry controller state (sync is link control, motion samples).
+#define FRAME_FLAGS_STATE 0b00111111
+
+#define FRAME_ACTIONS_LEN 256 // Action codes, same as the HID action matrix.
+#define FRAME_AXIS_SCALE 32767 // Unit axis value [-1,1] to int16.
+
+#define FRAME_AXIS_LX 0
+#define FRAME_AXIS_LY 1
+#define FRAME_AXIS_RX 2
+#define FRAME_AXIS_RY 3
+#define FRAME_AXIS_LZ 4
+#define FRAME_AXIS_RZ 5
+#define FRAME_AXIS_LEN 6
+
+#define FRAME_HISTORY_LEN 4 // Digital transitions repeated in every frame.
+#define FRAME_MOTION_LEN 3 // IMU samples per batch, as the Switch Pro input report.
+
+typedef struct
+{
+    // Must be packed (6 bytes).
+    uint8_t version;
+    uint8_t flags;
+    uint32_t time; // Sender microseconds when the state was captured.
+} __attribute__((packed)) FrameHeader;
+
+// Active digital actions. On the wire it is sparse, a count followed by the
+// active action codes (ascending), or FRAME_DIGITAL_BITMAP followed by the
+// whole bitmap, whichever is smaller.
+typedef struct
+{
+    uint8_t actions[FRAME_ACTIONS_LEN / 8]; // Bit N (LSB first) is action N.
+} FrameDigital;
+
+#define FRAME_DIGITAL_BITMAP 0xFF
+#define FRAME_DIGITAL_MAX_SIZE (1 + sizeof(FrameDigital))
+
+typedef struct
+{
+    // Must be packed (12 bytes).
+    int16_t axes[FRAME_AXIS_LEN]; // Resolved axes (including axis actions).
+} __attribute__((packed)) FrameAxes;
+
+typedef struct
+{
+    // Must be packed (5 bytes).
+    int16_t x;
+    int16_t y;
+    int8_t scroll;
+} __attribute__((packed)) FrameMouse;
+
+typedef struct
+{
+    // Must be packed (6 bytes).
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} __attribute__((packed)) FrameVector;
+
+typedef struct
+{
+    // Must be packed (3 bytes).
+    uint8_t sequence; // Counts transitions, not frames.
+    uint8_t action;   // Zero is an empty slot.
+    uint8_t pressed;
+} __attribute__((packed)) FrameTransition;
+
+typedef struct
+{
+    // Must be packed (12 bytes).
+    FrameTransition transitions[FRAME_HISTORY_LEN]; // Oldest first.
+} __attribute__((packed)) FrameHistory;
+
+// Clock sync exchange, NTP style. The receiver sends a frame with only this
+// section and its own time in request, the controller answers with the
+// request echoed and its own times. All times are microseconds (uint32, wrap).
+typedef struct
+{
+    // Must be packed (12 bytes).
+    uint32_t request;  // Receiver time when the request was sent.
+    uint32_t received; // Controller time when the request was received.
+    uint32_t sent;     // Controller time when the answer was sent.
+} __attribute__((packed)) FrameSync;
+
+typedef struct
+{
+    // Must be packed (14 bytes).
+    uint16_t age; // Microseconds from the sample to the frame time.
+    FrameVector gyro;
+    FrameVector accel;
+} __attribute__((packed)) FrameMotionSample;
+
+// IMU samples at the IMU rate, batched so the frame rate does not follow it.
+// On the wire only the used samples are sent (count and samples).
+typedef struct
+{
+    uint8_t len;
+    FrameMotionSample samples[FRAME_MOTION_LEN]; // Oldest first.
+} FrameMotion;
+
+#define FRAME_MOTION_MAX_SIZE (1 + sizeof(FrameMotionSample) * FRAME_MOTION_LEN)
+
+// Decoded frame. Sections not present in the wire are zeroed.
+typedef struct _Frame
+{
+    FrameHeader header;
+    FrameDigital digital;
+    FrameAxes axes;
+    FrameMouse mouse;
+    FrameVector gyro;
+    FrameVector accel;
+    FrameHistory history;
+    FrameSync sync;
+    FrameMotion motion;
+} Frame;
+
+#define FRAME_MAX_SIZE ( \
+    sizeof(FrameHeader) + \
+    FRAME_DIGITAL_MAX_SIZE + \
+    sizeof(FrameAxes) + \
+    sizeof(FrameMouse) + \
+    sizeof(FrameVector) * 2 + \
+    sizeof(FrameHistory) + \
+    sizeof(FrameSync) + \
+    FRAME_MOTION_MAX_SIZE)
+
+// Envelope used on byte streams (UART, TCP), so the receiver can find frames
+// again after lost or corrupted bytes:
+// | sync (2) | length (1) | sequence (2) | frame (length) | crc16 (2) |
+#define FRAME_SYNC_0 0xA5
+#define FRAME_SYNC_1 0x5A
+#define FRAME_ENVELOPE_HEADER_SIZE 5
+#define FRAME_ENVELOPE_SIZE (FRAME_ENVELOPE_HEADER_SIZE + 2)
+#define FRAME_PACKED_MAX_SIZE (FRAME_MAX_SIZE + FRAME_ENVELOPE_SIZE)
+// Frames up to this far behind are late and discarded, further behind means
+// the sender restarted its sequence.
+#define FRAME_REORDER_WINDOW 32
+
+typedef enum _FrameParserState
+{
+    FRAME_PARSER_SYNC_0,
+    FRAME_PARSER_SYNC_1,
+    FRAME_PARSER_LENGTH,
+    FRAME_PARSER_BODY,
+} FrameParserState;
+
+typedef struct
+{
+    uint32_t frames;     // Valid frames received.
+    uint32_t skipped;    // Bytes discarded while searching for a sync word, or with the rescan backlog full.
+    uint32_t crc_errors;
+    uint32_t format_errors; // Bad length or unsupported frame version.
+    uint32_t lost;       // Frames missing according to the sequence.
+    uint32_t reordered;  // Frames older than the last one, discarded.
+} FrameParserStats;
+
+typedef struct
+{
+    FrameParserState state;
+    uint8_t buffer[FRAME_PACKED_MAX_SIZE];
+    uint8_t index;
+    uint8_t expected;  // Total envelope size once the length is known.
+    uint8_t pending[FRAME_PACKED_MAX_SIZE + 1]; // Bytes to parse again, see frame_parser_rescan().
+    uint8_t pending_len;
+    uint8_t pending_index;
+    bool has_sequence;
+    uint16_t sequence; // Last accepted sequence number.
+    FrameParserStats stats;
+} FrameParser;
+
+// Estimation of the controller clock from sync exchanges, on the receiver.
+#define FRAME_CLOCK_SAMPLES 8 // Exchanges considered, the fastest one is used.
+#define FRAME_CLOCK_DRIFT_MIN_SPAN 1000000 // Microseconds between estimates.
+
+typedef struct
+{
+    uint32_t local;  // Receiver time when the answer arrived.
+    uint32_t offset; // Controller minus receiver time.
+    uint32_t rtt;    // Round trip without the controller processing time.
+} FrameClockSample;
+
+typedef struct
+{
+    FrameClockSample samples[FRAME_CLOCK_SAMPLES];
+    uint8_t count;
+    uint8_t head;
+    bool synced;
+    FrameClockSample best;  // Fastest exchange in the window.
+    FrameClockSample anchor; // Best exchange at the last drift update.
+    double drift;           // Offset change per receiver microsecond.
+} FrameClock;
+
+uint8_t frame_size(const Frame *frame);
+void frame_action_set(FrameDigital *digital, uint8_t action, bool active);
+bool frame_action_get(const FrameDigital *digital, uint8_t action);
+uint8_t frame_encode(uint8_t *buffer, const Frame *frame);
+bool frame_decode(const uint8_t *buffer, uint8_t len, Frame *frame);
+uint8_t frame_changes(const Frame *previous, const Frame *current);
+void frame_merge(Frame *state, const Frame *update);
+uint8_t frame_history_new(
+    const FrameHistory *history,
+    bool *has_sequence,
+    uint8_t *sequence,
+    FrameTransition *transitions
+);
+int16_t frame_quantize(double value, double scale);
+uint16_t frame_crc16(const uint8_t *data, uint16_t len);
+uint8_t frame_pack(uint8_t *buffer, uint16_t sequence, const Frame *frame);
+void frame_parser_init(FrameParser *parser);
+bool frame_parser_feed(FrameParser *parser, uint8_t byte, Frame *frame);
+void frame_clock_sample(FrameClock *clock, const FrameSync *sync, uint32_t arrival);
+uint32_t frame_clock_to_local(const FrameClock *clock, uint32_t remote);
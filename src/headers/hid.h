@@ -261,9 +261,12 @@
 #define PROC_ROTARY_MODE_5 PROC_INDEX + 40
 
 #define PROC_IGNORE_LED_WARNINGS PROC_INDEX + 41
+#define PROC_TRACE_DUMP PROC_INDEX + 42
 
 void hid_thanks();
 void hid_matrix_reset(uint8_t keep);
+void hid_matrix_sync();
+bool hid_bit(uint8_t action);
 void hid_press(uint8_t key);
 void hid_release(uint8_t key);
 void hid_press_multiple(uint8_t *keys);
@@ -290,6 +293,8 @@ void hid_gamepad_rz(double value);
 void hid_gamepad_gyro(double x, double y, double z);
 void hid_gamepad_accel(double x, double y, double z);
 void hid_report();
+bool hid_synced();
+void hid_idle();
 void hid_init();
 
 extern bool hid_allow_communication;
@@ -26,6 +26,9 @@
 void imu_init();
 Vector imu_read_gyro();
 Vector imu_read_accel();
+void imu_set_tick_samples(uint8_t samples);
+uint8_t imu_get_tick_samples();
+uint32_t imu_take_tick_time();
 void imu_load_calibration();
 void imu_calibrate();
 
@@ -0,0 +1,152 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "config.h"
+#include "vector.h"
+#include "hid.h"
+#include "transfer.h"
+
+// Output of the input components (buttons, thumbsticks, gyro, rotary), sent
+// to the sinks selected with CFG_OUTPUT_SINK: USB HID (hid.c), wireless
+// (transfer.c) or both mirrored. The selection is resolved at compile time and
+// the functions are inline, so a call costs the same as calling the sink.
+
+#if CFG_OUTPUT_SINK & OUTPUT_SINK_USB
+#define OUTPUT_USB(call) hid_##call
+#else
+#define OUTPUT_USB(call)
+#endif
+
+#if CFG_OUTPUT_SINK & OUTPUT_SINK_WIRELESS
+#define OUTPUT_WIRELESS(call) wifi_##call
+#else
+#define OUTPUT_WIRELESS(call)
+#endif
+
+static inline void output_matrix_reset(uint8_t keep)
+{
+    OUTPUT_USB(matrix_reset(keep));
+    OUTPUT_WIRELESS(matrix_reset(keep));
+}
+
+static inline void output_press(uint8_t key)
+{
+    OUTPUT_USB(press(key));
+    OUTPUT_WIRELESS(press(key));
+}
+
+static inline void output_release(uint8_t key)
+{
+    OUTPUT_USB(release(key));
+    OUTPUT_WIRELESS(release(key));
+}
+
+static inline void output_press_multiple(uint8_t *keys)
+{
+    OUTPUT_USB(press_multiple(keys));
+    OUTPUT_WIRELESS(press_multiple(keys));
+}
+
+static inline void output_release_multiple(uint8_t *keys)
+{
+    OUTPUT_USB(release_multiple(keys));
+    OUTPUT_WIRELESS(release_multiple(keys));
+}
+
+static inline void output_press_later(uint8_t key, uint16_t delay)
+{
+    OUTPUT_USB(press_later(key, delay));
+    OUTPUT_WIRELESS(press_later(key, delay));
+}
+
+static inline void output_release_later(uint8_t key, uint16_t delay)
+{
+    OUTPUT_USB(release_later(key, delay));
+    OUTPUT_WIRELESS(release_later(key, delay));
+}
+
+static inline void output_press_multiple_later(uint8_t *keys, uint16_t delay)
+{
+    OUTPUT_USB(press_multiple_later(keys, delay));
+    OUTPUT_WIRELESS(press_multiple_later(keys, delay));
+}
+
+static inline void output_release_multiple_later(uint8_t *keys, uint16_t delay)
+{
+    OUTPUT_USB(release_multiple_later(keys, delay));
+    OUTPUT_WIRELESS(release_multiple_later(keys, delay));
+}
+
+// Same action ranges in both sinks.
+static inline bool output_is_axis(uint8_t key)
+{
+    return hid_is_axis(key);
+}
+
+static inline bool output_is_mouse_move(uint8_t key)
+{
+    return hid_is_mouse_move(key);
+}
+
+static inline void output_mouse_move(int16_t x, int16_t y)
+{
+    OUTPUT_USB(mouse_move(x, y));
+    OUTPUT_WIRELESS(mouse_move(x, y));
+}
+
+static inline void output_gamepad_lx(double value)
+{
+    OUTPUT_USB(gamepad_lx(value));
+    OUTPUT_WIRELESS(gamepad_lx(value));
+}
+
+static inline void output_gamepad_ly(double value)
+{
+    OUTPUT_USB(gamepad_ly(value));
+    OUTPUT_WIRELESS(gamepad_ly(value));
+}
+
+static inline void output_gamepad_rx(double value)
+{
+    OUTPUT_USB(gamepad_rx(value));
+    OUTPUT_WIRELESS(gamepad_rx(value));
+}
+
+static inline void output_gamepad_ry(double value)
+{
+    OUTPUT_USB(gamepad_ry(value));
+    OUTPUT_WIRELESS(gamepad_ry(value));
+}
+
+static inline void output_gamepad_lz(double value)
+{
+    OUTPUT_USB(gamepad_lz(value));
+    OUTPUT_WIRELESS(gamepad_lz(value));
+}
+
+static inline void output_gamepad_rz(double value)
+{
+    OUTPUT_USB(gamepad_rz(value));
+    OUTPUT_WIRELESS(gamepad_rz(value));
+}
+
+static inline void output_gamepad_gyro(double x, double y, double z)
+{
+    OUTPUT_USB(gamepad_gyro(x, y, z));
+    OUTPUT_WIRELESS(gamepad_gyro(x, y, z));
+}
+
+static inline void output_gamepad_accel(double x, double y, double z)
+{
+    OUTPUT_USB(gamepad_accel(x, y, z));
+    OUTPUT_WIRELESS(gamepad_accel(x, y, z));
+}
+
+// Every IMU sample, only the wireless sink batches them (see transfer.c).
+static inline void output_gamepad_motion(Vector gyro, Vector accel)
+{
+    OUTPUT_WIRELESS(gamepad_motion(gyro, accel));
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "frame.h"
+
+// Receiver-side jitter buffer for the continuous sections of the frames (axes,
+// gyro, accel). Must not depend on the Pico SDK.
+
+#define PLAYOUT_LEN 16 // Must be a power of 2.
+#define PLAYOUT_MIN_DELAY 1000 // Microseconds over the fastest transit seen.
+#define PLAYOUT_MAX_DELAY 30000 // Microseconds.
+#define PLAYOUT_JITTER_FACTOR 3 // Delay in jitter units.
+#define PLAYOUT_JITTER_SMOOTH 16 // Same smoothing as RFC 3550.
+#define PLAYOUT_OFFSET_CREEP 2 // Microseconds per frame, so the fastest transit can increase.
+#define PLAYOUT_EXTRAPOLATION_MAX 8000 // Microseconds.
+
+typedef struct
+{
+    uint32_t time; // Sender time, microseconds.
+    FrameAxes axes;
+    FrameVector gyro;
+    FrameVector accel;
+} PlayoutEntry;
+
+typedef struct
+{
+    uint32_t played;       // Entries played on time.
+    uint32_t late;         // Entries that arrived after their playout time.
+    uint32_t dropped;      // Entries dropped because the buffer was full.
+    uint32_t extrapolated; // Samples extrapolated because the next entry was late.
+} PlayoutStats;
+
+typedef struct
+{
+    PlayoutEntry entries[PLAYOUT_LEN];
+    uint8_t head;  // Free running, pushed.
+    uint8_t tail;  // Free running, played.
+    bool has_offset;
+    uint32_t offset;   // Receiver minus sender time of the fastest transit.
+    uint32_t transit;  // Transit of the last entry pushed.
+    uint32_t jitter;   // Microseconds, smoothed.
+    uint32_t delay;    // Microseconds over the fastest transit.
+    uint8_t played;    // Entries played, up to 2 (current and previous).
+    bool has_axes;
+    FrameAxes axes;    // Axes of the last entry pushed.
+    PlayoutEntry current;
+    PlayoutEntry previous;
+    PlayoutEntry output;
+    PlayoutStats stats;
+} Playout;
+
+void playout_init(Playout *playout);
+void playout_push(Playout *playout, const Frame *state, const FrameMotion *motion, uint32_t arrival);
+bool playout_sample(Playout *playout, uint32_t now, Frame *frame);
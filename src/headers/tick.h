@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <pico/stdlib.h>
+#include "config.h"
+
+typedef struct
+{
+    uint32_t ticks;     // Ticks run, total.
+    uint32_t missed;    // Deadlines skipped because a tick ran over, total.
+    uint32_t phase_max; // Worst start of a tick after its deadline, microseconds.
+    float phase_avg;    // Start of a tick after its deadline, microseconds, smoothed.
+    int16_t sof_error;  // Last USB frame phase error, microseconds.
+    bool sof_locked;    // Phase-locked to the USB frames.
+    uint32_t slack_max; // Worst time from sampling to the next USB frame, microseconds.
+    float slack_avg;    // Time from sampling to the next USB frame, microseconds, smoothed.
+} TickStats;
+
+#define TICK_USB_FRAME 1000 // Full speed frame, microseconds.
+#define TICK_SOF_GAIN 4 // The phase error is corrected by a fraction per tick.
+#define TICK_SOF_LOCKED 50 // Microseconds.
+
+void tick_init(uint32_t frequency);
+void tick_wait();
+void tick_report_done();
+TickStats tick_get_stats();
+void tick_reset_stats();
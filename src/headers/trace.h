@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <pico/stdlib.h>
+
+#define TRACE_LEN 256 // Must be a power of 2.
+
+typedef enum _TraceEvent
+{
+    TRACE_TX = 1,
+    TRACE_RX,
+} TraceEvent;
+
+typedef struct __packed _TraceEntry
+{
+    // Must be packed (10 bytes).
+    uint32_t time;     // Microseconds since boot (wraps).
+    uint16_t sequence; // Envelope sequence number.
+    uint8_t event;     // TraceEvent.
+    uint8_t flags;     // Frame sections.
+    uint8_t size;      // Bytes on the wire.
+    uint8_t queue;     // TX ring usage after the event, in 16 byte units.
+} TraceEntry;
+
+void trace_frame(TraceEvent event, uint16_t sequence, uint8_t flags, uint8_t size);
+void trace_dump();
+void trace_task();
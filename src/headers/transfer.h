@@ -13,13 +13,14 @@
 #include "pin.h"
 #include "common.h"
 #include "switch_pro.h"
+#include "frame.h"
 
 
 typedef struct {
     bool wifi_allow_communication;  // Extern.
-    bool synced_keyboard;
-    bool synced_mouse;
-    bool synced_gamepad;
+    uint8_t dirty;  // Frame sections changed since the last report.
+    FrameHistory history;  // Last digital transitions, oldest first.
+    uint8_t history_sequence;
     uint16_t alarms;
     alarm_pool_t *alarm_pool;
 
@@ -56,6 +57,7 @@ void wifi_press_multiple_later_callback(alarm_id_t alarm, uint8_t *keys);
 void wifi_release_multiple_later_callback(alarm_id_t alarm, uint8_t *keys);
 void wifi_macro(uint8_t index);
 bool wifi_is_axis(uint8_t key);
+uint8_t wifi_section(uint8_t key);
 bool wifi_is_mouse_move(uint8_t key);
 void wifi_mouse_move(int16_t x, int16_t y);
 //void wifi_mouse_wheel(int8_t z);
@@ -67,7 +69,9 @@ void wifi_gamepad_lz(double value);
 void wifi_gamepad_rz(double value);
 void wifi_gamepad_gyro(double x, double y, double z);
 void wifi_gamepad_accel(double x, double y, double z);
+void wifi_gamepad_motion(Vector gyro, Vector accel);
 
+void wifi_tick_reset();
 void wifi_report();
 void wifi_init();
 
@@ -128,7 +128,7 @@
       ADDR_XINPUT_IN, /* bEndpointAddress */          \
       0x03,           /* bmAttributes */              \
       0x20, 0x00,     /* wMaxPacketSize */            \
-      0x04            /* bInterval */
+      CFG_TICK_INTERVAL /* bInterval (one tick) */
 
 // XINPUT OUT端点描述符
 #define DESCRIPTOR_ENDPOINT_XINPUT_OUT                 \
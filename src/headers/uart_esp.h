@@ -17,7 +17,42 @@
 
 #define UART_TX_PIN 0
 #define UART_RX_PIN 1
+#define UART_CTS_PIN 2
+#define UART_RTS_PIN 3
+
+#define UART_TX_RING_SIZE 1024  // Must be a power of 2.
+#define UART_RX_RING_SIZE 512  // Must be a power of 2.
+
+typedef struct
+{
+    uint32_t bytes;      // Bytes committed to the ring.
+    uint32_t commits;    // Messages committed to the ring.
+    uint32_t overflows;  // Messages dropped because the ring was full.
+    uint16_t high_water; // Maximum ring usage seen.
+} UartTxStats;
+
+typedef struct
+{
+    uint32_t bytes;      // Bytes received into the ring.
+    uint32_t overflows;  // Bytes dropped because the ring was full.
+    uint32_t overruns;   // Bytes lost by the UART FIFO before the IRQ read it.
+    uint32_t errors;     // Bytes with break, parity or framing errors.
+} UartRxStats;
 
 void init_uart();
+uint32_t uart_esp_set_baudrate(uint32_t baudrate, bool flow_control);
+uint32_t uart_esp_get_baudrate();
+bool uart_esp_get_flow_control();
+void uart_esp_tx_init();
+bool uart_esp_tx_enqueue(const uint8_t *data, uint16_t len);
+bool uart_esp_tx_commit();
+uint16_t uart_esp_tx_pending();
+void uart_esp_tx_wait();
+bool uart_esp_tx_idle();
+UartTxStats uart_esp_tx_stats();
+void uart_esp_rx_init();
+uint16_t uart_esp_rx_read(uint8_t *data, uint16_t len);
+UartRxStats uart_esp_rx_stats();
+uint32_t uart_esp_rx_timestamp();
 
 
@@ -5,57 +5,62 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include "transfer.h"
+#include "playout.h"
 
 
-// 定义结构体来组织数据
-typedef struct {
-    bool synced_keyboard;
-    bool synced_mouse;
-    bool synced_gamepad;
-    uint8_t state_matrix[256];
-} DataPacket;
-
-// 在这里定义矩阵大小常量（如果还没有定义的话）
-#ifndef MATRIX_ROWS
-#define MATRIX_ROWS 6
-#endif
-#ifndef MATRIX_COLS
-#define MATRIX_COLS 14
-#endif
-
-// 声明全局变量
-// 定义全局变量
-extern bool hid_allow_communication = true;
-extern bool synced_keyboard = false;
-extern bool synced_mouse = false;
-extern bool synced_gamepad = false;
-
-extern uint16_t alarms = 0;
-extern alarm_pool_t *alarm_pool;
+// 声明全局变量（定义在 hid.c）
+extern bool hid_allow_communication;
+extern bool synced_keyboard;
+extern bool synced_mouse;
+extern bool synced_gamepad;
 
-extern uint8_t state_matrix[256] = {
-    0,
-};
+extern uint8_t state_matrix[256];
 
-extern int16_t mouse_x = 0;
-extern int16_t mouse_y = 0;
+extern int16_t mouse_x;
+extern int16_t mouse_y;
 
-extern double gamepad_lx = 0;
-extern double gamepad_ly = 0;
-extern double gamepad_rx = 0;
-extern double gamepad_ry = 0;
-extern double gamepad_lz = 0;
-extern double gamepad_rz = 0;
+extern double gamepad_lx;
+extern double gamepad_ly;
+extern double gamepad_rx;
+extern double gamepad_ry;
+extern double gamepad_lz;
+extern double gamepad_rz;
 
-extern Vector gamepad_gyro = 0;
-extern Vector gamepad_accel = 0;
+extern Vector gamepad_gyro;
+extern Vector gamepad_accel;
 
 extern SwitchProUsb switchProUsb;
+extern alarm_pool_t *alarm_pool;
+
+// Link health, refreshed every second (see wifi_stats_task()).
+typedef struct
+{
+    uint32_t tx_bytes;    // Bytes written to the ESP, per second.
+    uint16_t frames;      // Frames sent, per second.
+    uint16_t queue;       // TX ring usage, bytes.
+    uint16_t queue_max;   // TX ring maximum usage since boot, bytes.
+    uint32_t dropped;     // Frames dropped because the TX ring was full, total.
+    uint16_t reconnects;  // Links lost and associated again, total.
+    uint16_t at_latency;  // Last ESP AT response time, milliseconds.
+    int8_t rssi;          // dBm, zero if unknown.
+} WifiStats;
 
-bool sendCMD(const char *cmd, const char *act);
 void connectToWifi();
+void wifi_sta_task();
+bool wifi_is_connected();
+WifiStats wifi_get_stats();
+void wifi_stats_print();
 
 void send_data_to_esp8285(uint8_t *data, int data_size);
-void sendPacketOverWiFi(DataPacket packet);
+void wifi_frame_from_transfer(const transfer_struct *packet, Frame *frame);
+void sendPacketOverWiFi(const Frame *frame);
+const transfer_struct* receivePacketOverWiFi();
+FrameParserStats receivePacketStats();
+PlayoutStats receivePlayoutStats();
+uint32_t receivePlayoutDelay();
+uint32_t receivePacketTime();
+void process_received_packet(const transfer_struct *received_packet);
+
 
 
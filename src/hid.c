@@ -15,7 +15,9 @@ Physical controller --> Profile --> [HID layer] --> HID keyboard
 At the end of each cycle (determined by the polling rate) the HID layer checks
 if the potential new report is different from the last report sent to the
 interfaces (USB keyboard, USB mouse, gamepad...), and sends the report if
-required.
+required. The HID endpoint takes one report at a time, so the reports of the
+cycle are queued (one slot per device) and submitted one after the other as
+the previous one completes, all of them going out within the same cycle.
 
 The state matrix is a representation of all the actions that could be sent
 (output) and internal operations (procedures) requested by the user. It keep
@@ -23,12 +25,19 @@ track of how many references to these actions are active.
 As a simplification: Button presses increase the counter by one, and button
 releases decrease the counter by one.
 
+Next to the counters, the state bits keep the set of active actions (counter
+above zero), one bit per action. They only change when a counter crosses zero,
+and only then the corresponding device is flagged as not synced, so the reports
+are built with a few word operations instead of reading the whole matrix.
+
 To avoid orphan references, the state matrix is usually re-initialized (reset)
 to zeros when the user changes the active profile, otherwise the disabled
 profile won't ever trigger the corresponding counter decrease of held buttons
 during the profile change.
 */
 
+#include <string.h>
+#include <pico/assert.h>
 #include <tusb.h>
 #include "config.h"
 #include "ctrl.h"
@@ -49,6 +58,7 @@ during the profile change.
 #include "dual_shock_4.h"
 #include "dual_sense.h"
 #include "vector.h"
+#include "trace.h"
 
 bool hid_allow_communication = true; // Extern.
 bool synced_keyboard = false;
@@ -60,6 +70,22 @@ alarm_pool_t *alarm_pool;
 uint8_t state_matrix[256] = {
     0,
 };
+uint32_t state_bits[8] = {0};
+
+#define HID_QUEUE_KEYBOARD 0
+#define HID_QUEUE_MOUSE 1
+#define HID_QUEUE_GAMEPAD 2
+#define HID_QUEUE_LEN 3
+#define HID_REPORT_MAX_SIZE 63  // Endpoint size minus the report ID.
+
+typedef struct {
+    bool pending;
+    uint8_t id;
+    uint8_t len;
+    uint8_t data[HID_REPORT_MAX_SIZE];
+} HidQueued;
+
+HidQueued hid_queue[HID_QUEUE_LEN] = {0};
 int16_t mouse_x = 0;
 int16_t mouse_y = 0;
 double gamepad_lx = 0;
@@ -75,18 +101,86 @@ Vector gamepad_accel = {0};
 // input_report_t switch_pro_gamepad_data;
 SwitchProUsb switchProUsb;
 
+// Whether the action is active (its counter in the state matrix is not zero).
+bool hid_bit(uint8_t action)
+{
+    return (state_bits[action >> 5] >> (action & 31)) & 1;
+}
+
+// Up to 32 consecutive bits of the state bits, starting at the given action.
+static uint32_t hid_bits(uint8_t first, uint8_t count)
+{
+    uint8_t word = first >> 5;
+    uint64_t bits = state_bits[word];
+    if (word < 7)
+        bits |= (uint64_t)state_bits[word + 1] << 32;
+    bits >>= (first & 31);
+    return (uint32_t)(bits & ((1ULL << count) - 1));
+}
+
+// Whether any action between first and last (inclusive) is active.
+static bool hid_bits_any(uint8_t first, uint8_t last)
+{
+    for (uint8_t word = first >> 5; word <= (last >> 5); word++)
+    {
+        uint32_t mask = 0xFFFFFFFF;
+        if (word == (first >> 5))
+            mask &= 0xFFFFFFFF << (first & 31);
+        if (word == (last >> 5))
+            mask &= 0xFFFFFFFF >> (31 - (last & 31));
+        if (state_bits[word] & mask)
+            return true;
+    }
+    return false;
+}
+
+static void hid_unsync(uint8_t key)
+{
+    if (key >= GAMEPAD_INDEX)
+        synced_gamepad = false;
+    else if (key >= MOUSE_INDEX)
+        synced_mouse = false;
+    else
+        synced_keyboard = false;
+}
+
+// Rebuild the state bits from the counters, when the matrix is written as a
+// whole (eg: the dongle receiving a frame).
+void hid_matrix_sync()
+{
+    for (uint8_t word = 0; word < 8; word++)
+    {
+        uint32_t bits = 0;
+        for (uint8_t i = 0; i < 32; i++)
+        {
+            if (state_matrix[(word << 5) + i])
+                bits |= 1UL << i;
+        }
+        state_bits[word] = bits;
+    }
+}
+
 // 重置state_matrix中的信息
 void hid_matrix_reset(uint8_t keep)
 {
-    for (uint8_t action = 0; action < 255; action++)
+    // Only the devices with active actions need a report.
+    if (hid_bits_any(0, MODIFIER_INDEX_END))
+        synced_keyboard = false;
+    if (hid_bits_any(MOUSE_INDEX, MOUSE_INDEX_END))
+        synced_mouse = false;
+    if (hid_bits_any(GAMEPAD_INDEX, PROC_INDEX_END))
+        synced_gamepad = false;
+    // Optionally do not reset specific actions.
+    uint8_t keep_value = state_matrix[keep];
+    bool keep_bit = hid_bit(keep);
+    memset(state_matrix, 0, sizeof(state_matrix));
+    memset(state_bits, 0, sizeof(state_bits));
+    if (keep)
     {
-        if (action == keep)
-            continue; // Optionally do not reset specific actions.
-        state_matrix[action] = 0;
+        state_matrix[keep] = keep_value;
+        if (keep_bit)
+            state_bits[keep >> 5] |= 1UL << (keep & 31);
     }
-    synced_keyboard = false;
-    synced_mouse = false;
-    synced_gamepad = false;
 }
 
 // 处理按下动作
@@ -142,6 +236,8 @@ void hid_procedure_press(uint8_t procedure)
         hid_thanks();
     if (procedure == PROC_IGNORE_LED_WARNINGS)
         config_ignore_problems();
+    if (procedure == PROC_TRACE_DUMP)
+        trace_dump();
     // Scrollwheel alternative modes. (Used for example in Racing profile).
     if (procedure == PROC_ROTARY_MODE_0)
         rotary_set_mode(0);
@@ -195,12 +291,13 @@ void hid_press(uint8_t key)
     {
         // 根据 key 的范围更新相应设备的同步标志
         state_matrix[key] += 1;
-        if (key >= GAMEPAD_INDEX)
-            synced_gamepad = false;
-        else if (key >= MOUSE_INDEX)
-            synced_mouse = false;
-        else
-            synced_keyboard = false;
+        if (state_matrix[key] == 1)
+        {
+            state_bits[key >> 5] |= 1UL << (key & 31);
+            hid_unsync(key);
+        }
+        else if (key == MOUSE_SCROLL_UP || key == MOUSE_SCROLL_DOWN)
+            synced_mouse = false; // Every press is a scroll step.
     }
 }
 
@@ -220,12 +317,11 @@ void hid_release(uint8_t key)
         if (state_matrix[key] > 0)
         { // Do not allow to wrap / go negative.
             state_matrix[key] -= 1;
-            if (key >= GAMEPAD_INDEX)
-                synced_gamepad = false;
-            else if (key >= MOUSE_INDEX)
-                synced_mouse = false;
-            else
-                synced_keyboard = false;
+            if (state_matrix[key] == 0)
+            {
+                state_bits[key >> 5] &= ~(1UL << (key & 31));
+                hid_unsync(key);
+            }
         }
     }
 }
@@ -457,14 +553,66 @@ void hid_gamepad_accel(double x, double y, double z)
     };
 }
 
-void hid_mouse_report()
+// Submit the next queued report, if the endpoint is free.
+void hid_queue_submit()
 {
-    // Create button bitmask.
-    int8_t buttons = 0;
-    for (int i = 0; i < 5; i++)
+    for (uint8_t i = 0; i < HID_QUEUE_LEN; i++)
     {
-        buttons += state_matrix[MOUSE_INDEX + i] << i;
+        if (!hid_queue[i].pending)
+            continue;
+        if (!tud_hid_ready())
+            return;
+        hid_queue[i].pending = false;
+        tud_hid_report(hid_queue[i].id, hid_queue[i].data, hid_queue[i].len);
+        return;
     }
+}
+
+void hid_queue_add(uint8_t device, uint8_t id, const void *report, uint8_t len)
+{
+    hard_assert(len <= HID_REPORT_MAX_SIZE);
+    hid_queue[device].id = id;
+    hid_queue[device].len = len;
+    memcpy(hid_queue[device].data, report, len);
+    hid_queue[device].pending = true;
+}
+
+bool hid_queue_busy()
+{
+    for (uint8_t i = 0; i < HID_QUEUE_LEN; i++)
+    {
+        if (hid_queue[i].pending)
+            return true;
+    }
+    return false;
+}
+
+// Every device got the last state into its report, none is waiting for the
+// previous report to go out. XInput is not queued, it is always reported.
+bool hid_synced()
+{
+    bool gamepad = synced_gamepad || config_current_protocol_is_xusb();
+    return synced_keyboard && synced_mouse && gamepad;
+}
+
+// The previous report is out, next one.
+void tud_hid_report_complete_cb(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+    hid_queue_submit();
+}
+
+// Called while the loop waits for the next cycle (see tick.c), serving the USB
+// events so the reports still queued go out as soon as the endpoint is free.
+void hid_idle()
+{
+    if (hid_queue_busy())
+        tud_task();
+}
+
+void hid_mouse_report()
+{
+    // Button bitmask, straight from the state bits.
+    int8_t buttons = hid_bits(MOUSE_INDEX, 5);
     uint8_t scroll = state_matrix[MOUSE_SCROLL_UP] - state_matrix[MOUSE_SCROLL_DOWN];
     // Create report.
     hid_mouse_custom_report_t report = {buttons, mouse_x, mouse_y, scroll, 0};
@@ -473,41 +621,36 @@ void hid_mouse_report()
     mouse_y = 0;
     state_matrix[MOUSE_SCROLL_UP] = 0;
     state_matrix[MOUSE_SCROLL_DOWN] = 0;
-    // Send report.
-    tud_hid_report(MOUSE_INPUT_ID, &report, sizeof(report));
+    state_bits[(MOUSE_SCROLL_UP) >> 5] &= ~(0b11UL << ((MOUSE_SCROLL_UP) & 31));
+    // Queue report.
+    hid_queue_add(HID_QUEUE_MOUSE, MOUSE_INPUT_ID, &report, sizeof(report));
 }
 
 // 函数讲state_matrix[i]的信息，读到report[]与modifier里面，state_matrix中的信息来自于hid_press、hid_release这两个函数
 void hid_keyboard_report()
 {
-    uint8_t report[6] = {0};    // 初始化report信息数组
+    hid_keyboard_report_t report = {0};     // 初始化report信息
     uint8_t keys_available = 6;
-    for (int i = 0; i <= 115; i++)  // 115键键盘
+    // 115键键盘, keys 0~115 are the first 4 words of the state bits, only the
+    // active ones are visited (lowest first).
+    for (uint8_t word = 0; word < 4 && keys_available > 0; word++)
     {
-        if (state_matrix[i] >= 1)   // 信息都存在state_matrix[i]里面，如果[i]按键按下，则为 1 。
+        uint32_t bits = state_bits[word];
+        if (word == 3)
+            bits &= 0x000FFFFF; // Up to key 115.
+        while (bits && keys_available > 0)
         {
-            report[keys_available - 1] = (uint8_t)i;    // 当对应的键盘按键处于按下状态时，
-                                                        // 将该按键的编码（这里就是循环变量 i）转换为无符号 8 位整数类型，
-                                                        // 并存储到 report 数组中可用位置的最后一个元素。
+            uint8_t i = (word << 5) + __builtin_ctz(bits);
+            bits &= bits - 1;
+            // 将按下的按键编码存储到 report 数组中可用位置的最后一个元素。
+            report.keycode[keys_available - 1] = i;
             keys_available--;
-            if (keys_available == 0)
-            {
-                break;
-            }
         }
     }
-    // 存储计算得到的修饰键信息
-    uint8_t modifier = 0;
-    // 对 8 个可能的修饰键状态进行检查和计算
-    for (int i = 0; i < 8; i++)
-    {
-        modifier += !!state_matrix[MODIFIER_INDEX + i] << i;
-    }
-    // 发送刚刚生成的键盘报告。在这里需要进行修改，在手柄端将报告数组通过串口发送给ESP8285，在监视狗端把函数经由USB发送给PC
-    tud_hid_keyboard_report(
-        KEYBRD_INPUT_ID,
-        modifier,
-        report);
+    // 8 个修饰键, consecutive in the state bits.
+    report.modifier = hid_bits(MODIFIER_INDEX, 8);
+    // 发送刚刚生成的键盘报告 (queued, see hid_queue_submit).
+    hid_queue_add(HID_QUEUE_KEYBOARD, KEYBRD_INPUT_ID, &report, sizeof(report));
 }
 
 double hid_axis(
@@ -517,16 +660,16 @@ double hid_axis(
 {
     if (matrix_index_neg)
     {
-        if (state_matrix[matrix_index_neg])
+        if (hid_bit(matrix_index_neg))
             return -1;
-        else if (state_matrix[matrix_index_pos])
+        else if (hid_bit(matrix_index_pos))
             return 1;
         else
             return constrain(value, -1, 1);
     }
     else
     {
-        if (state_matrix[matrix_index_pos])
+        if (hid_bit(matrix_index_pos))
             return 1;
         else
             return constrain(fabs(value), 0, 1);
@@ -537,21 +680,21 @@ void hid_gamepad_report()
 {
     // Sorted so the most common assigned buttons are lower and easier to
     // identify in-game.
-    int32_t buttons = ((state_matrix[GAMEPAD_A] << 0) +
-                       (state_matrix[GAMEPAD_B] << 1) +
-                       (state_matrix[GAMEPAD_X] << 2) +
-                       (state_matrix[GAMEPAD_Y] << 3) +
-                       (state_matrix[GAMEPAD_L1] << 4) +
-                       (state_matrix[GAMEPAD_R1] << 5) +
-                       (state_matrix[GAMEPAD_L3] << 6) +
-                       (state_matrix[GAMEPAD_R3] << 7) +
-                       (state_matrix[GAMEPAD_LEFT] << 8) +
-                       (state_matrix[GAMEPAD_RIGHT] << 9) +
-                       (state_matrix[GAMEPAD_UP] << 10) +
-                       (state_matrix[GAMEPAD_DOWN] << 11) +
-                       (state_matrix[GAMEPAD_SELECT] << 12) +
-                       (state_matrix[GAMEPAD_START] << 13) +
-                       (state_matrix[GAMEPAD_HOME] << 14));
+    int32_t buttons = ((hid_bit(GAMEPAD_A) << 0) +
+                       (hid_bit(GAMEPAD_B) << 1) +
+                       (hid_bit(GAMEPAD_X) << 2) +
+                       (hid_bit(GAMEPAD_Y) << 3) +
+                       (hid_bit(GAMEPAD_L1) << 4) +
+                       (hid_bit(GAMEPAD_R1) << 5) +
+                       (hid_bit(GAMEPAD_L3) << 6) +
+                       (hid_bit(GAMEPAD_R3) << 7) +
+                       (hid_bit(GAMEPAD_LEFT) << 8) +
+                       (hid_bit(GAMEPAD_RIGHT) << 9) +
+                       (hid_bit(GAMEPAD_UP) << 10) +
+                       (hid_bit(GAMEPAD_DOWN) << 11) +
+                       (hid_bit(GAMEPAD_SELECT) << 12) +
+                       (hid_bit(GAMEPAD_START) << 13) +
+                       (hid_bit(GAMEPAD_HOME) << 14));
     // Adjust range from [-1,1] to [-32767,32767].
     int16_t lx_report = hid_axis(gamepad_lx, GAMEPAD_AXIS_LX, GAMEPAD_AXIS_LX_NEG) * BIT_15;
     int16_t ly_report = hid_axis(gamepad_ly, GAMEPAD_AXIS_LY, GAMEPAD_AXIS_LY_NEG) * BIT_15;
@@ -571,21 +714,15 @@ void hid_gamepad_report()
         rz_report,
         buttons,
     };
-    tud_hid_report(GENERIC_INPUT_ID, &report, sizeof(report));
+    hid_queue_add(HID_QUEUE_GAMEPAD, GENERIC_INPUT_ID, &report, sizeof(report));
 }
 
 void hid_xinput_report()
 {
-    int8_t buttons_0 = 0;
-    int8_t buttons_1 = 0;
-    for (int i = 0; i < 8; i++)
-    {
-        buttons_0 += state_matrix[GAMEPAD_INDEX + i] << i;
-    }
-    for (int i = 0; i < 8; i++)
-    {
-        buttons_1 += state_matrix[GAMEPAD_INDEX + i + 8] << i;
-    }
+    // XInput buttons are in the same order as the gamepad actions.
+    uint16_t buttons = hid_bits(GAMEPAD_INDEX, 16);
+    int8_t buttons_0 = buttons & 0xFF;
+    int8_t buttons_1 = buttons >> 8;
     // Adjust range from [-1,1] to [-32767,32767].
     int16_t lx_report = hid_axis(gamepad_lx, GAMEPAD_AXIS_LX, GAMEPAD_AXIS_LX_NEG) * BIT_15;
     int16_t ly_report = hid_axis(gamepad_ly, GAMEPAD_AXIS_LY, GAMEPAD_AXIS_LY_NEG) * BIT_15;
@@ -686,24 +823,24 @@ void switch_pro_gamepad_data_update()
     // uint16_t lz_report = hid_axis(gamepad_lz, GAMEPAD_AXIS_LZ, 0) * BIT_8;
     // uint16_t rz_report = hid_axis(gamepad_rz, GAMEPAD_AXIS_RZ, 0) * BIT_8;
     switchProUsb.gamepad_data.id = SWITCH_PRO_USB_INPUT_ID_FULL_CONTROLLER_STATE;
-    switchProUsb.gamepad_data.controller_data.button.A = state_matrix[GAMEPAD_A];
-    switchProUsb.gamepad_data.controller_data.button.B = state_matrix[GAMEPAD_B];
-    switchProUsb.gamepad_data.controller_data.button.X = state_matrix[GAMEPAD_X];
-    switchProUsb.gamepad_data.controller_data.button.Y = state_matrix[GAMEPAD_Y];
-    switchProUsb.gamepad_data.controller_data.button.L = state_matrix[GAMEPAD_L1];
-    switchProUsb.gamepad_data.controller_data.button.R = state_matrix[GAMEPAD_R1];
+    switchProUsb.gamepad_data.controller_data.button.A = hid_bit(GAMEPAD_A);
+    switchProUsb.gamepad_data.controller_data.button.B = hid_bit(GAMEPAD_B);
+    switchProUsb.gamepad_data.controller_data.button.X = hid_bit(GAMEPAD_X);
+    switchProUsb.gamepad_data.controller_data.button.Y = hid_bit(GAMEPAD_Y);
+    switchProUsb.gamepad_data.controller_data.button.L = hid_bit(GAMEPAD_L1);
+    switchProUsb.gamepad_data.controller_data.button.R = hid_bit(GAMEPAD_R1);
     switchProUsb.gamepad_data.controller_data.button.ZL = hid_axis(gamepad_lz, GAMEPAD_AXIS_LZ, 0);
     switchProUsb.gamepad_data.controller_data.button.ZR = hid_axis(gamepad_rz, GAMEPAD_AXIS_RZ, 0);
-    switchProUsb.gamepad_data.controller_data.button.MINUS = state_matrix[GAMEPAD_SELECT];
-    switchProUsb.gamepad_data.controller_data.button.PLUS = state_matrix[GAMEPAD_START];
-    switchProUsb.gamepad_data.controller_data.button.LS = state_matrix[GAMEPAD_L3];
-    switchProUsb.gamepad_data.controller_data.button.RS = state_matrix[GAMEPAD_R3];
-    switchProUsb.gamepad_data.controller_data.button.HOME = state_matrix[GAMEPAD_HOME];
+    switchProUsb.gamepad_data.controller_data.button.MINUS = hid_bit(GAMEPAD_SELECT);
+    switchProUsb.gamepad_data.controller_data.button.PLUS = hid_bit(GAMEPAD_START);
+    switchProUsb.gamepad_data.controller_data.button.LS = hid_bit(GAMEPAD_L3);
+    switchProUsb.gamepad_data.controller_data.button.RS = hid_bit(GAMEPAD_R3);
+    switchProUsb.gamepad_data.controller_data.button.HOME = hid_bit(GAMEPAD_HOME);
     switchProUsb.gamepad_data.controller_data.button.CAPTURE = 0;
-    switchProUsb.gamepad_data.controller_data.button.DPAD_UP = state_matrix[GAMEPAD_UP];
-    switchProUsb.gamepad_data.controller_data.button.DPAD_DOWN = state_matrix[GAMEPAD_DOWN];
-    switchProUsb.gamepad_data.controller_data.button.DPAD_LEFT = state_matrix[GAMEPAD_LEFT];
-    switchProUsb.gamepad_data.controller_data.button.DPAD_RIGHT = state_matrix[GAMEPAD_RIGHT];
+    switchProUsb.gamepad_data.controller_data.button.DPAD_UP = hid_bit(GAMEPAD_UP);
+    switchProUsb.gamepad_data.controller_data.button.DPAD_DOWN = hid_bit(GAMEPAD_DOWN);
+    switchProUsb.gamepad_data.controller_data.button.DPAD_LEFT = hid_bit(GAMEPAD_LEFT);
+    switchProUsb.gamepad_data.controller_data.button.DPAD_RIGHT = hid_bit(GAMEPAD_RIGHT);
     switchProUsb.gamepad_data.controller_data.left_stick.X = lx_report;
     switchProUsb.gamepad_data.controller_data.left_stick.Y = ly_report;
     switchProUsb.gamepad_data.controller_data.right_stick.X = rx_report;
@@ -719,7 +856,7 @@ void switch_pro_gamepad_data_update()
 
     switchProUsb.handle_input_0x30(&switchProUsb);
     if (switchProUsb.hid_report_open)
-        tud_hid_report(switchProUsb.hid_report_buffer[0], &switchProUsb.hid_report_buffer[1], SWITCH_PRO_USB_REPORT_SIZE);
+        hid_queue_add(HID_QUEUE_GAMEPAD, switchProUsb.hid_report_buffer[0], &switchProUsb.hid_report_buffer[1], SWITCH_PRO_USB_REPORT_SIZE);
     // const uint8_t *u8_report = (const uint8_t *)&report;
     // tud_hid_report(u8_report[0], &u8_report[1], SWITCH_PRO_USB_INPUT_REPORT_FULL_SIZE);
 }
@@ -794,23 +931,23 @@ void hid_dual_shock_4_report()
     report.State.State.State.RightStickX = rx_report;
     report.State.State.State.RightStickY = ry_report;
     report.State.State.State.DPad = dpad_button_to_hat_switch_8(
-        state_matrix[GAMEPAD_UP],
-        state_matrix[GAMEPAD_DOWN],
-        state_matrix[GAMEPAD_LEFT],
-        state_matrix[GAMEPAD_RIGHT]);
-    report.State.State.State.ButtonSquare = state_matrix[GAMEPAD_Y];
-    report.State.State.State.ButtonCross = state_matrix[GAMEPAD_B];
-    report.State.State.State.ButtonCircle = state_matrix[GAMEPAD_A];
-    report.State.State.State.ButtonTriangle = state_matrix[GAMEPAD_X];
-    report.State.State.State.ButtonL1 = state_matrix[GAMEPAD_L1];
-    report.State.State.State.ButtonR1 = state_matrix[GAMEPAD_R1];
+        hid_bit(GAMEPAD_UP),
+        hid_bit(GAMEPAD_DOWN),
+        hid_bit(GAMEPAD_LEFT),
+        hid_bit(GAMEPAD_RIGHT));
+    report.State.State.State.ButtonSquare = hid_bit(GAMEPAD_Y);
+    report.State.State.State.ButtonCross = hid_bit(GAMEPAD_B);
+    report.State.State.State.ButtonCircle = hid_bit(GAMEPAD_A);
+    report.State.State.State.ButtonTriangle = hid_bit(GAMEPAD_X);
+    report.State.State.State.ButtonL1 = hid_bit(GAMEPAD_L1);
+    report.State.State.State.ButtonR1 = hid_bit(GAMEPAD_R1);
     report.State.State.State.ButtonL2 = lz_report > 0;
     report.State.State.State.ButtonR2 = rz_report > 0;
-    report.State.State.State.ButtonShare = state_matrix[GAMEPAD_SELECT];
-    report.State.State.State.ButtonOptions = state_matrix[GAMEPAD_START];
-    report.State.State.State.ButtonL3 = state_matrix[GAMEPAD_L3];
-    report.State.State.State.ButtonR3 = state_matrix[GAMEPAD_R3];
-    report.State.State.State.ButtonHome = state_matrix[GAMEPAD_HOME];
+    report.State.State.State.ButtonShare = hid_bit(GAMEPAD_SELECT);
+    report.State.State.State.ButtonOptions = hid_bit(GAMEPAD_START);
+    report.State.State.State.ButtonL3 = hid_bit(GAMEPAD_L3);
+    report.State.State.State.ButtonR3 = hid_bit(GAMEPAD_R3);
+    report.State.State.State.ButtonHome = hid_bit(GAMEPAD_HOME);
     report.State.State.State.TriggerLeft = lz_report;
     report.State.State.State.TriggerRight = rz_report;
 
@@ -822,7 +959,7 @@ void hid_dual_shock_4_report()
     report.State.State.AccelerometerZ = (int16_t)(gamepad_accel.y / 1.9);
 
     const uint8_t *u8_report = (const uint8_t *)&report;
-    tud_hid_report(u8_report[0], &u8_report[1], sizeof(report) - 1);
+    hid_queue_add(HID_QUEUE_GAMEPAD, u8_report[0], &u8_report[1], sizeof(report) - 1);
 }
 
 void hid_dual_sense_report()
@@ -845,23 +982,23 @@ void hid_dual_sense_report()
     report.State.TriggerLeft = lz_report;
     report.State.TriggerRight = rz_report;
     report.State.DPad = dpad_button_to_hat_switch_8(
-        state_matrix[GAMEPAD_UP],
-        state_matrix[GAMEPAD_DOWN],
-        state_matrix[GAMEPAD_LEFT],
-        state_matrix[GAMEPAD_RIGHT]);
-    report.State.ButtonSquare = state_matrix[GAMEPAD_Y];
-    report.State.ButtonCross = state_matrix[GAMEPAD_B];
-    report.State.ButtonCircle = state_matrix[GAMEPAD_A];
-    report.State.ButtonTriangle = state_matrix[GAMEPAD_X];
-    report.State.ButtonL1 = state_matrix[GAMEPAD_L1];
-    report.State.ButtonR1 = state_matrix[GAMEPAD_R1];
+        hid_bit(GAMEPAD_UP),
+        hid_bit(GAMEPAD_DOWN),
+        hid_bit(GAMEPAD_LEFT),
+        hid_bit(GAMEPAD_RIGHT));
+    report.State.ButtonSquare = hid_bit(GAMEPAD_Y);
+    report.State.ButtonCross = hid_bit(GAMEPAD_B);
+    report.State.ButtonCircle = hid_bit(GAMEPAD_A);
+    report.State.ButtonTriangle = hid_bit(GAMEPAD_X);
+    report.State.ButtonL1 = hid_bit(GAMEPAD_L1);
+    report.State.ButtonR1 = hid_bit(GAMEPAD_R1);
     report.State.ButtonL2 = lz_report > 0;
     report.State.ButtonR2 = rz_report > 0;
-    report.State.ButtonCreate = state_matrix[GAMEPAD_SELECT];
-    report.State.ButtonOptions = state_matrix[GAMEPAD_START];
-    report.State.ButtonL3 = state_matrix[GAMEPAD_L3];
-    report.State.ButtonR3 = state_matrix[GAMEPAD_R3];
-    report.State.ButtonHome = state_matrix[GAMEPAD_HOME];
+    report.State.ButtonCreate = hid_bit(GAMEPAD_SELECT);
+    report.State.ButtonOptions = hid_bit(GAMEPAD_START);
+    report.State.ButtonL3 = hid_bit(GAMEPAD_L3);
+    report.State.ButtonR3 = hid_bit(GAMEPAD_R3);
+    report.State.ButtonHome = hid_bit(GAMEPAD_HOME);
 
     report.State.AngularVelocityX = (int16_t)(-gamepad_gyro.y / 1.9);
     report.State.AngularVelocityZ = (int16_t)(-gamepad_gyro.x / 1.9);
@@ -871,7 +1008,7 @@ void hid_dual_sense_report()
     report.State.AccelerometerZ = (int16_t)(gamepad_accel.y / 1.9);
 
     const uint8_t *u8_report = (const uint8_t *)&report;
-    tud_hid_report(u8_report[0], &u8_report[1], sizeof(report) - 1);
+    hid_queue_add(HID_QUEUE_GAMEPAD, u8_report[0], &u8_report[1], sizeof(report) - 1);
 }
 
 void hid_gamepad_reset()
@@ -892,18 +1029,6 @@ void hid_report()
 {
     static bool is_tud_ready = false;
     static bool is_tud_ready_logged = false;
-    static uint8_t priority_mouse = 0;
-    static uint8_t priority_gamepad = 0;
-    // synced_gamepad = false;
-
-    // Not all events are sent everytime, they are delivered based on their
-    // priority ratio and how long they have been queueing.
-    // For example thumbstick movement may be queued for some cycles if there
-    // is a lot of mouse data being sent.
-    if (!synced_mouse)
-        priority_mouse += 1 * CFG_HID_REPORT_PRIORITY_RATIO;
-    if (!synced_gamepad)
-        priority_gamepad += 1;
 
     if (!hid_allow_communication)
         return;
@@ -916,70 +1041,61 @@ void hid_report()
             is_tud_ready_logged = true;
             info("USB: tud_ready TRUE\n");
         }
-        if (tud_hid_ready())
+        // 当前协议兼容 WebUSB ，与inputs lab的网页上位机连接，读取上位机对手柄的修改
+        if (tud_hid_ready() && current_protocol_compatible_with_webusb())
         {
-            // 当前协议兼容 WebUSB ，与inputs lab的网页上位机连接，读取上位机对手柄的修改
-            if (current_protocol_compatible_with_webusb())
+            webusb_read();      // 读取 config 、status或者...
+            webusb_flush();     // ensure webusb data transfer is complete.
+        }
+        // Every device that changed is queued in this cycle. If the previous
+        // report of a device is still queued, it waits for the next cycle (so
+        // for example mouse motion keeps adding up).
+        // 键盘同步，发送 modifier 值、report 数组，当在使用键盘，有按下、松开动作的时候，都会同步键盘
+        if (!synced_keyboard && !hid_queue[HID_QUEUE_KEYBOARD].pending)
+        {
+            hid_keyboard_report();
+            synced_keyboard = true;
+        }
+        // 鼠标信息还没同步
+        if (!synced_mouse && !hid_queue[HID_QUEUE_MOUSE].pending)
+        {
+            hid_mouse_report();
+            synced_mouse = true;
+        }
+        // 手柄按键信息还没同步，在有按键按下、松开，摇杆运动时，都会同步游戏手柄的数据信息
+        if (!synced_gamepad && !hid_queue[HID_QUEUE_GAMEPAD].pending)
+        {
+            // 原生按键协议
+            if (config_get_protocol() == PROTOCOL_GENERIC)
             {
-                webusb_read();      // 读取 config 、status或者...
-                webusb_flush();     // ensure webusb data transfer is complete.
+                hid_gamepad_report();
+                synced_gamepad = true;
             }
-            // 键盘同步，发送 modifier 值、report 数组，当在使用键盘，有按下、松开动作的时候，都会同步键盘
-            if (!synced_keyboard)
+            // switch pro 协议
+            else if (config_get_protocol() == PROTOCOL_SWITCH_PRO)
             {
-                // report 键盘信息，tud_hid_keyboard_report函数上报信息，
-                hid_keyboard_report();
-                synced_keyboard = true;
+                switch_pro_gamepad_data_update();
+                synced_gamepad = true;
             }
-            // 鼠标信息还没同步，且鼠标优先级计数高于手柄按键，当在使用键盘，且鼠标优先级高于键盘时，有按下、松开动作的时候，都会同步鼠标
-            else if (!synced_mouse && (priority_mouse > priority_gamepad))
+            // else if (config_get_protocol() == PROTOCOL_XBOX_1914) {
+            //     // hid_xbox1914_report();
+            //     synced_gamepad = true;
+            // }
+            // dual shock 4 协议
+            else if (config_get_protocol() == PROTOCOL_DUAL_SHOCK_4)
             {
-                // report 鼠标信息，返回 report 数组
-                hid_mouse_report();
-                synced_mouse = true;
-                priority_mouse = 0;
+                hid_dual_shock_4_report();
+                synced_gamepad = true;
             }
-            // 手柄按键信息还没同步，且按键优先级高于鼠标时，在有按键按下、松开，摇杆运动时，都会同步游戏手柄的数据信息
-            else if (!synced_gamepad)
+            // dual sense 协议
+            else if (config_get_protocol() == PROTOCOL_DUAL_SENSE)
             {
-                // 原生按键协议
-                if (config_get_protocol() == PROTOCOL_GENERIC)
-                {
-                    // report 按键信息，返回 report 数组
-                    hid_gamepad_report();
-                    synced_gamepad = true;
-                    priority_gamepad = 0;
-                }
-                // switch pro 协议
-                else if (config_get_protocol() == PROTOCOL_SWITCH_PRO)
-                {
-                    // report switch 按键信息，返回 report 数组
-                    switch_pro_gamepad_data_update();
-                    synced_gamepad = true;
-                    priority_gamepad = 0;
-                }
-                // else if (config_get_protocol() == PROTOCOL_XBOX_1914) {
-                //     // hid_xbox1914_report();
-                //     synced_gamepad = true;
-                //     priority_gamepad = 0;
-                // }
-                // dual shock 4 协议
-                else if (config_get_protocol() == PROTOCOL_DUAL_SHOCK_4)
-                {
-                    // report PS4 dualshock 4 按键信息，返回 u8_report 数组
-                    hid_dual_shock_4_report();
-                    synced_gamepad = true;
-                    priority_gamepad = 0;
-                }
-                // dual sense 协议
-                else if (config_get_protocol() == PROTOCOL_DUAL_SENSE)
-                {
-                    hid_dual_sense_report();
-                    synced_gamepad = true;
-                    priority_gamepad = 0;
-                }
+                hid_dual_sense_report();
+                synced_gamepad = true;
             }
         }
+        // The first one now, the rest from tud_hid_report_complete_cb.
+        hid_queue_submit();
         // xinput 协议
         if (!synced_gamepad)
         {
@@ -990,7 +1106,6 @@ void hid_report()
                     tud_remote_wakeup();
                 }
                 hid_xinput_report();
-                priority_gamepad = 0;
             }
         }
         // Gamepad values being reset so potentially unsent values are not
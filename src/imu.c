@@ -21,6 +21,8 @@
 
 uint8_t IMU0 = 0;
 uint8_t IMU1 = 0;
+uint8_t imu_tick_samples = CFG_IMU_TICK_SAMPLES;
+uint32_t imu_tick_time = 0; // Time spent sampling since last taken.
 double offset_gyro_0_x;
 double offset_gyro_0_y;
 double offset_gyro_0_z;
@@ -139,8 +141,10 @@ Vector imu_read_gyro_burst(uint8_t cs, uint8_t samples)
  */
 Vector imu_read_gyro()
 {
-    Vector gyro0 = imu_read_gyro_burst(IMU0, CFG_IMU_TICK_SAMPLES / 8 * 1);
-    Vector gyro1 = imu_read_gyro_burst(IMU1, CFG_IMU_TICK_SAMPLES / 8 * 7); // 先除以 7 
+    uint32_t start = time_us_32();
+    Vector gyro0 = imu_read_gyro_burst(IMU0, imu_tick_samples / 8 * 1);
+    Vector gyro1 = imu_read_gyro_burst(IMU1, imu_tick_samples / 8 * 7); // 先除以 7 
+    imu_tick_time += time_us_32() - start;
     // 计算gyro1的xyz真实值，计算两个惯性单元的权重值 weight0 & 1
     double weight = max(abs(gyro1.x), abs(gyro1.y)) / 32768.0;  
     // 在输入值的范围两端形成所谓的 “死区（deadzone）” 效果，并且这种变换是基于给定的因子 z 来进行的。
@@ -155,6 +159,24 @@ Vector imu_read_gyro()
     return (Vector){x, y, z};
 }
 
+// Multi-sampling can be lowered when the tick runs out of time (see main.c).
+void imu_set_tick_samples(uint8_t samples)
+{
+    imu_tick_samples = constrain(samples, CFG_IMU_TICK_SAMPLES_MIN, CFG_IMU_TICK_SAMPLES);
+}
+
+uint8_t imu_get_tick_samples()
+{
+    return imu_tick_samples;
+}
+
+uint32_t imu_take_tick_time()
+{
+    uint32_t time = imu_tick_time;
+    imu_tick_time = 0;
+    return time;
+}
+
 Vector imu_read_accel()
 {
     Vector accel0 = imu_read_accel_bits(IMU0);
@@ -22,6 +22,8 @@
 #include "logging.h"
 #include "common.h"
 #include "transfer.h"
+#include "trace.h"
+#include "tick.h"
 
 #if __has_include("version.h")
 #include "version.h"
@@ -78,26 +80,13 @@ void main_init()
     bus_init();
     // HID 初始化，创建一个警报池
     hid_init();
+    wifi_init();
 
-    // 连接WIFI
-    sendCMD("AT+CIPSEND", ">");
-    led_blink_ms(2000);
-
-    uart_puts(UART_ID, "Hello World!");
-    uart_puts(UART_ID, "\r\n");
-
-    char send_data[3] = {'1', '2', '3'};
-    // send_data_to_esp8285(send_data, sizeof(send_data));
-
-    DataPacket mypacket;
-    mypacket.synced_keyboard = true;
-    mypacket.synced_mouse = false;
-    mypacket.synced_gamepad = true;
-
-    for (int i = 0; i < 256; i++)
-    {
-        mypacket.state_matrix[i] = 1;
-    }
+    // 连接WIFI，在主循环中后台完成
+#if CFG_OUTPUT_SINK & OUTPUT_SINK_WIRELESS
+    init_uart();
+    connectToWifi();
+#endif
 
     // 摇杆初始化
     thumbstick_init();
@@ -114,25 +103,88 @@ void main_init()
     imu_init();
 }
 
+// Keep the stages of the tick within their time budget. The IMU
+// multi-sampling is the only cost that can be lowered, so any overrun halves
+// it, and it is doubled back (at most once per second) when it would fit again.
+void main_budget(uint32_t tick, uint32_t profile, uint32_t report)
+{
+    static uint16_t relaxed = 0;
+    static uint32_t overruns = 0;
+    uint32_t interval = 1000000 / CFG_TICK_FREQUENCY;
+    uint32_t sampling = imu_take_tick_time();
+    profile -= min(sampling, profile);
+    uint8_t samples = imu_get_tick_samples();
+    bool overrun = (
+        tick > interval ||
+        sampling > interval * CFG_TICK_BUDGET_SAMPLING / 100 ||
+        profile > interval * CFG_TICK_BUDGET_PROFILE / 100 ||
+        report > interval * CFG_TICK_BUDGET_REPORT / 100);
+    if (overrun)
+    {
+        overruns++;
+        relaxed = 0;
+        if (samples > CFG_IMU_TICK_SAMPLES_MIN)
+        {
+            imu_set_tick_samples(samples / 2);
+            debug(
+                "Loop: overrun (sampling=%lu profile=%lu report=%lu) IMU samples=%i overruns=%lu\n",
+                sampling, profile, report, imu_get_tick_samples(), overruns);
+        }
+    }
+    else if (samples < CFG_IMU_TICK_SAMPLES)
+    {
+        bool fits = (
+            sampling * 2 <= interval * CFG_TICK_BUDGET_SAMPLING / 100 &&
+            tick + sampling < interval);
+        relaxed = fits ? relaxed + 1 : 0;
+        if (relaxed >= CFG_TICK_FREQUENCY)
+        {
+            relaxed = 0;
+            imu_set_tick_samples(samples * 2);
+            debug("Loop: IMU samples=%i\n", imu_get_tick_samples());
+        }
+    }
+}
+
 void main_loop()
 {
     info("INIT: Main loop\n");
     int16_t i = 0;
     logging_set_onloop(true);
+    tick_init(CFG_TICK_FREQUENCY);
     while (true)
     {
         i++;
+        // Wait for the deadline of this tick.
+        tick_wait();
         // Start timer.
         uint32_t tick_start = time_us_32();
         // Config.
         config_sync();
-        // Report.
+        // Wireless link bring-up.
+#if CFG_OUTPUT_SINK & OUTPUT_SINK_WIRELESS
+        wifi_sta_task();
+#endif
+        // Report (see output.h for the sinks).
+        uint32_t stage_start = time_us_32();
         profile_report_active();
+        uint32_t stage_profile = time_us_32() - stage_start;
+        stage_start = time_us_32();
+#if CFG_OUTPUT_SINK & OUTPUT_SINK_WIRELESS
+        wifi_report();
+#endif
         hid_report();
+        tick_report_done();
+        uint32_t stage_report = time_us_32() - stage_start;
+        // Wireless trace dump, if requested.
+        trace_task();
         // Tick interval control.
         uint32_t tick_completed = time_us_32() - tick_start;
         uint16_t tick_interval = 1000000 / CFG_TICK_FREQUENCY;
-        int32_t tick_idle = tick_interval - (int32_t)tick_completed;
+        if (tick_completed > tick_interval)
+            info("+");
+        // Time budget of each stage.
+        main_budget(tick_completed, stage_profile, stage_report);
         // Listen to incoming UART messages. 每 250 次循环后监听一次
         uart_listen_char(i);
         // Timing stats.
@@ -142,13 +194,25 @@ void main_loop()
             static float average = 0;
             average = smooth(average, tick_completed, 100);
             if (!(i % 2000))
-                debug("Loop: avg=%.0f (us)\n", average);
+            {
+                TickStats tick = tick_get_stats();
+                debug(
+                    "Loop: avg=%.0f (us) phase avg=%.0f max=%lu (us) missed=%lu\n",
+                    average,
+                    tick.phase_avg,
+                    (unsigned long)tick.phase_max,
+                    (unsigned long)tick.missed);
+#if CFG_TICK_SOF_SYNC
+                debug(
+                    "Loop: USB frame %s error=%i (us) slack avg=%.0f max=%lu (us)\n",
+                    tick.sof_locked ? "locked" : "unlocked",
+                    tick.sof_error,
+                    tick.slack_avg,
+                    (unsigned long)tick.slack_max);
+#endif
+                tick_reset_stats();
+            }
         }
-        // Idling control.
-        if (tick_idle > 0)
-            sleep_us((uint32_t)tick_idle);
-        else
-            info("+");
     }
 }
 
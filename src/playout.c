@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Wi-Fi delivers frames in bursts, so without a buffer the receiver would replay
+stick and motion changes in clumps. The continuous sections (axes, gyro, accel)
+are instead played on the timeline of the sender, using the capture time in the
+frame header, with a delay that adapts to the jitter observed.
+
+The sender and receiver clocks are not related, what is known is the transit
+(arrival time minus sender time) of each frame. The fastest transit seen is the
+reference, every frame is played at its sender time plus the reference plus
+the delay. The reference creeps up slowly, so it follows clock drift and path
+changes, and jumps down when a faster frame arrives.
+
+If the next frame is late, the axes are extrapolated linearly from the last two
+frames for a short time (gyro and accel are held).
+
+Digital and mouse sections are not delayed.
+*/
+
+#include <string.h>
+#include "playout.h"
+
+#define PLAYOUT_MASK (PLAYOUT_LEN - 1)
+
+void playout_init(Playout *playout)
+{
+    memset(playout, 0, sizeof(Playout));
+    playout->delay = PLAYOUT_MIN_DELAY;
+}
+
+static uint32_t playout_time(const Playout *playout, const PlayoutEntry *entry)
+{
+    return entry->time + playout->offset + playout->delay;
+}
+
+static void playout_add(
+    Playout *playout,
+    const FrameAxes *axes,
+    uint32_t time,
+    const FrameVector *gyro,
+    const FrameVector *accel,
+    uint32_t arrival)
+{
+    if ((uint8_t)(playout->head - playout->tail) == PLAYOUT_LEN)
+    {
+        playout->tail += 1;
+        playout->stats.dropped += 1;
+    }
+    PlayoutEntry *entry = &playout->entries[playout->head & PLAYOUT_MASK];
+    entry->time = time;
+    entry->axes = *axes;
+    playout->axes = *axes;
+    playout->has_axes = true;
+    entry->gyro = *gyro;
+    entry->accel = *accel;
+    if ((int32_t)(arrival - playout_time(playout, entry)) > 0)
+        playout->stats.late += 1;
+    playout->head += 1;
+}
+
+// Add the state after a frame was merged, arrival in receiver microseconds.
+// The IMU samples of the motion batch of the frame (if any) are added as one
+// entry each at their own capture time, so they are played at the rate they
+// were sampled instead of only the newest one.
+void playout_push(Playout *playout, const Frame *state, const FrameMotion *motion, uint32_t arrival)
+{
+    uint32_t transit = arrival - state->header.time;
+    if (playout->has_offset)
+    {
+        // Jitter as in RFC 3550.
+        int32_t difference = (int32_t)(transit - playout->transit);
+        uint32_t magnitude = difference < 0 ? -difference : difference;
+        playout->jitter += ((int32_t)magnitude - (int32_t)playout->jitter) / PLAYOUT_JITTER_SMOOTH;
+        playout->offset += PLAYOUT_OFFSET_CREEP;
+    }
+    if (!playout->has_offset || (int32_t)(transit - playout->offset) < 0)
+    {
+        playout->offset = transit;
+        playout->has_offset = true;
+    }
+    playout->transit = transit;
+    uint32_t delay = PLAYOUT_MIN_DELAY + (playout->jitter * PLAYOUT_JITTER_FACTOR);
+    playout->delay = delay < PLAYOUT_MAX_DELAY ? delay : PLAYOUT_MAX_DELAY;
+    if (!motion || !motion->len)
+    {
+        playout_add(playout, &state->axes, state->header.time, &state->gyro, &state->accel, arrival);
+        return;
+    }
+    // Oldest first. The axes are the ones of the frame time, the samples taken
+    // before keep the previous ones.
+    uint8_t len = motion->len < FRAME_MOTION_LEN ? motion->len : FRAME_MOTION_LEN;
+    FrameAxes previous = playout->has_axes ? playout->axes : state->axes;
+    for (uint8_t i = 0; i < len; i++)
+    {
+        const FrameMotionSample *sample = &motion->samples[i];
+        const FrameAxes *axes = (i == len - 1) ? &state->axes : &previous;
+        playout_add(playout, axes, state->header.time - sample->age, &sample->gyro, &sample->accel, arrival);
+    }
+}
+
+static int16_t playout_extrapolate(int16_t previous, int16_t current, int32_t interval, int32_t elapsed)
+{
+    int32_t value = current + ((int32_t)(current - previous) * elapsed / interval);
+    if (value > 32767)
+        return 32767;
+    if (value < -32767)
+        return -32767;
+    return value;
+}
+
+// Write the continuous sections due at the given receiver time into the frame.
+// Returns true if they changed since the previous call.
+bool playout_sample(Playout *playout, uint32_t now, Frame *frame)
+{
+    while (playout->tail != playout->head)
+    {
+        PlayoutEntry *entry = &playout->entries[playout->tail & PLAYOUT_MASK];
+        if ((int32_t)(now - playout_time(playout, entry)) < 0)
+            break;
+        playout->previous = playout->current;
+        playout->current = *entry;
+        if (playout->played < 2)
+            playout->played += 1;
+        playout->tail += 1;
+        playout->stats.played += 1;
+    }
+    if (!playout->played)
+        return false;
+    PlayoutEntry output = playout->current;
+    if (playout->played == 2 && playout->tail == playout->head)
+    {
+        // Nothing buffered, extrapolate if the next entry is already late.
+        int32_t interval = playout->current.time - playout->previous.time;
+        int32_t elapsed = now - playout_time(playout, &playout->current);
+        if (interval > 0 && elapsed > interval)
+        {
+            if (elapsed > PLAYOUT_EXTRAPOLATION_MAX)
+                elapsed = PLAYOUT_EXTRAPOLATION_MAX;
+            for (uint8_t i = 0; i < FRAME_AXIS_LEN; i++)
+            {
+                output.axes.axes[i] = playout_extrapolate(
+                    playout->previous.axes.axes[i],
+                    playout->current.axes.axes[i],
+                    interval,
+                    elapsed);
+            }
+            playout->stats.extrapolated += 1;
+        }
+    }
+    output.time = 0; // Only the values are compared.
+    frame->axes = output.axes;
+    frame->gyro = output.gyro;
+    frame->accel = output.accel;
+    bool changed = memcmp(&output, &playout->output, sizeof(PlayoutEntry)) != 0;
+    playout->output = output;
+    return changed;
+}
@@ -15,7 +15,7 @@
 #include "webusb.h"
 #include "logging.h"
 #include "common.h"
-#include "transfer.h"
+#include "output.h"
 
 Profile profiles[PROFILE_SLOTS];
 uint8_t profile_active_index = -1;
@@ -327,7 +327,7 @@ void profile_update_leds()
 void profile_reset_all()
 {
     // Reset HID state matrix. Optionally keep certain actions.
-    hid_matrix_reset(pending_reset_keep);
+    output_matrix_reset(pending_reset_keep);
     // Reset all profiles runtimes.
     profile_reset_all_profiles();
     // Reset flags.
@@ -18,7 +18,7 @@
 #include "profile.h"
 #include "logging.h"
 #include "webusb.h"
-#include "transfer.h"
+#include "output.h"
 
 const uint8_t rts_x_adc_channel = 3;
 const uint8_t rts_y_adc_channel = 2;
@@ -81,25 +81,25 @@ void right_thumbstick_calibrate()
 void right_thumbstick_report_axis(uint8_t axis, float value)
 {
     if (axis == GAMEPAD_AXIS_LX)
-        wifi_gamepad_lx(value);
+        output_gamepad_lx(value);
     else if (axis == GAMEPAD_AXIS_LY)
-        wifi_gamepad_ly(value);
+        output_gamepad_ly(value);
     else if (axis == GAMEPAD_AXIS_RX)
-        wifi_gamepad_rx(value);
+        output_gamepad_rx(value);
     else if (axis == GAMEPAD_AXIS_RY)
-        wifi_gamepad_ry(value);
+        output_gamepad_ry(value);
     else if (axis == GAMEPAD_AXIS_LX_NEG)
-        wifi_gamepad_lx(-value);
+        output_gamepad_lx(-value);
     else if (axis == GAMEPAD_AXIS_LY_NEG)
-        wifi_gamepad_ly(-value);
+        output_gamepad_ly(-value);
     else if (axis == GAMEPAD_AXIS_RX_NEG)
-        wifi_gamepad_rx(-value);
+        output_gamepad_rx(-value);
     else if (axis == GAMEPAD_AXIS_RY_NEG)
-        wifi_gamepad_ry(-value);
+        output_gamepad_ry(-value);
     else if (axis == GAMEPAD_AXIS_LZ)
-        wifi_gamepad_lz(value);
+        output_gamepad_lz(value);
     else if (axis == GAMEPAD_AXIS_RZ)
-        wifi_gamepad_rz(value);
+        output_gamepad_rz(value);
 }
 
 void right_thumbstick_report_mouse_move(uint8_t action, float thumbstick_value, int response_curve, int sensitivity_level)
@@ -140,15 +140,23 @@ void right_thumbstick_report_mouse_move(uint8_t action, float thumbstick_value,
     //         once_timer = 0;
     //     }
     // }
+    // Motion per tick, the subpixel leftover is carried to the next tick.
+    static double sub[4] = {0};
+    uint8_t index = action - MOUSE_X;
+    if (index < 4)
+    {
+        mouse_move_value = mouse_move_value * CFG_TICK_SCALE + sub[index];
+        sub[index] = mouse_move_value - trunc(mouse_move_value);
+    }
     int16_t value = constrain(mouse_move_value, -BIT_7, BIT_7);
     if (action == MOUSE_X)
-        wifi_mouse_move(value, 0);
+        output_mouse_move(value, 0);
     else if (action == MOUSE_Y)
-        wifi_mouse_move(0, value);
+        output_mouse_move(0, value);
     else if (action == MOUSE_X_NEG)
-        wifi_mouse_move(-value, 0);
+        output_mouse_move(-value, 0);
     else if (action == MOUSE_Y_NEG)
-        wifi_mouse_move(0, -value);
+        output_mouse_move(0, -value);
 }
 
 uint8_t right_thumbstick_get_direction(RThumbstick *self, float angle)
@@ -219,9 +227,9 @@ void right_thumbstick_report_axial(
     // Report directional virtual buttons or axis.
     bool report_mouse_move = false;
     //// Left.
-    if (wifi_is_axis(self->left.actions[0]))
+    if (output_is_axis(self->left.actions[0]))
         right_thumbstick_report_axis(self->left.actions[0], -constrain(pos.x, -1, 0));
-    else if (wifi_is_mouse_move(self->left.actions[0]))
+    else if (output_is_mouse_move(self->left.actions[0]))
     {
         right_thumbstick_report_mouse_move(self->left.actions[0],
                                            -constrain(pos.x, -1, 0),
@@ -232,9 +240,9 @@ void right_thumbstick_report_axial(
     else
         self->left.report(&self->left);
     //// Right.
-    if (wifi_is_axis(self->right.actions[0]))
+    if (output_is_axis(self->right.actions[0]))
         right_thumbstick_report_axis(self->right.actions[0], constrain(pos.x, 0, 1));
-    else if (wifi_is_mouse_move(self->right.actions[0]))
+    else if (output_is_mouse_move(self->right.actions[0]))
     {
         right_thumbstick_report_mouse_move(self->right.actions[0],
                                            constrain(pos.x, 0, 1),
@@ -245,9 +253,9 @@ void right_thumbstick_report_axial(
     else
         self->right.report(&self->right);
     //// Up.
-    if (wifi_is_axis(self->up.actions[0]))
+    if (output_is_axis(self->up.actions[0]))
         right_thumbstick_report_axis(self->up.actions[0], -constrain(pos.y, -1, 0));
-    else if (wifi_is_mouse_move(self->up.actions[0]))
+    else if (output_is_mouse_move(self->up.actions[0]))
     {
         right_thumbstick_report_mouse_move(self->up.actions[0],
                                            -constrain(pos.y, -1, 0),
@@ -258,9 +266,9 @@ void right_thumbstick_report_axial(
     else
         self->up.report(&self->up);
     //// Down.
-    if (wifi_is_axis(self->down.actions[0]))
+    if (output_is_axis(self->down.actions[0]))
         right_thumbstick_report_axis(self->down.actions[0], constrain(pos.y, 0, 1));
-    else if (wifi_is_mouse_move(self->down.actions[0]))
+    else if (output_is_mouse_move(self->down.actions[0]))
     {
         right_thumbstick_report_mouse_move(self->down.actions[0],
                                            constrain(pos.y, 0, 1),
@@ -273,13 +281,13 @@ void right_thumbstick_report_axial(
     //// DIR8_MASK
     if (!report_mouse_move)
     {
-        if (!wifi_is_axis(self->up_left.actions[0]))
+        if (!output_is_axis(self->up_left.actions[0]))
             self->up_left.report(&self->up_left);
-        if (!wifi_is_axis(self->up_right.actions[0]))
+        if (!output_is_axis(self->up_right.actions[0]))
             self->up_right.report(&self->up_right);
-        if (!wifi_is_axis(self->down_left.actions[0]))
+        if (!output_is_axis(self->down_left.actions[0]))
             self->down_left.report(&self->down_left);
-        if (!wifi_is_axis(self->down_right.actions[0]))
+        if (!output_is_axis(self->down_right.actions[0]))
             self->down_right.report(&self->down_right);
     }
     // Report push.
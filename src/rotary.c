@@ -13,7 +13,7 @@
 #include "rotary.h"
 #include "hid.h"
 #include "logging.h"
-#include "transfer.h"
+#include "output.h"
 
 void rotary_set_mode(uint8_t value)
 {
@@ -56,8 +56,8 @@ void Rotary__report(Rotary *self)
         for (uint8_t rotated = 0; rotated < abs(self->increment); rotated++)
         {
             uint8_t *actions = (self->increment > 0 ? self->actions[self->mode][ROTARY_UP] : self->actions[self->mode][ROTARY_DOWN]);
-            wifi_press_multiple(actions);
-            wifi_release_multiple_later(actions, 10);
+            output_press_multiple(actions);
+            output_release_multiple_later(actions, 10);
         }
         self->increment = 0;
         self->pending = false;
@@ -16,7 +16,7 @@
 #include "profile.h"
 #include "logging.h"
 #include "webusb.h"
-#include "transfer.h"
+#include "output.h"
 
 const uint8_t lts_x_adc_channel = 1;
 const uint8_t lts_y_adc_channel = 0;
@@ -91,25 +91,25 @@ void thumbstick_init()
 void thumbstick_report_axis(uint8_t axis, float value)
 {
     if (axis == GAMEPAD_AXIS_LX)
-        wifi_gamepad_lx(value);
+        output_gamepad_lx(value);
     else if (axis == GAMEPAD_AXIS_LY)
-        wifi_gamepad_ly(value);
+        output_gamepad_ly(value);
     else if (axis == GAMEPAD_AXIS_RX)
-        wifi_gamepad_rx(value);
+        output_gamepad_rx(value);
     else if (axis == GAMEPAD_AXIS_RY)
-        wifi_gamepad_ry(value);
+        output_gamepad_ry(value);
     else if (axis == GAMEPAD_AXIS_LX_NEG)
-        wifi_gamepad_lx(-value);
+        output_gamepad_lx(-value);
     else if (axis == GAMEPAD_AXIS_LY_NEG)
-        wifi_gamepad_ly(-value);
+        output_gamepad_ly(-value);
     else if (axis == GAMEPAD_AXIS_RX_NEG)
-        wifi_gamepad_rx(-value);
+        output_gamepad_rx(-value);
     else if (axis == GAMEPAD_AXIS_RY_NEG)
-        wifi_gamepad_ry(-value);
+        output_gamepad_ry(-value);
     else if (axis == GAMEPAD_AXIS_LZ)
-        wifi_gamepad_lz(value);
+        output_gamepad_lz(value);
     else if (axis == GAMEPAD_AXIS_RZ)
-        wifi_gamepad_rz(value);
+        output_gamepad_rz(value);
 }
 
 uint8_t thumbstick_get_direction(float angle, float overlap)
@@ -173,22 +173,22 @@ void Thumbstick__report_axial(
     }
     // Report directional virtual buttons or axis.
     //// Left.
-    if (!wifi_is_axis(self->left.actions[0]))
+    if (!output_is_axis(self->left.actions[0]))
         self->left.report(&self->left);
     else
         thumbstick_report_axis(self->left.actions[0], -constrain(pos.x, -1, 0));
     //// Right.
-    if (!wifi_is_axis(self->right.actions[0]))
+    if (!output_is_axis(self->right.actions[0]))
         self->right.report(&self->right);
     else
         thumbstick_report_axis(self->right.actions[0], constrain(pos.x, 0, 1));
     //// Up.
-    if (!wifi_is_axis(self->up.actions[0]))
+    if (!output_is_axis(self->up.actions[0]))
         self->up.report(&self->up);
     else
         thumbstick_report_axis(self->up.actions[0], -constrain(pos.y, -1, 0));
     //// Down.
-    if (!wifi_is_axis(self->down.actions[0]))
+    if (!output_is_axis(self->down.actions[0]))
         self->down.report(&self->down);
     else
         thumbstick_report_axis(self->down.actions[0], constrain(pos.y, 0, 1));
@@ -237,8 +237,8 @@ void Thumbstick__report_glyphstick(Thumbstick *self, Glyph input)
         // Trigger actions if matches.
         if (match)
         {
-            wifi_press_multiple(self->glyphstick_actions[i]);
-            wifi_release_multiple_later(self->glyphstick_actions[i], 100);
+            output_press_multiple(self->glyphstick_actions[i]);
+            output_release_multiple_later(self->glyphstick_actions[i], 100);
             break;
         }
     }
@@ -254,26 +254,26 @@ void Thumbstick__report_daisywheel(Thumbstick *self, Dir8 dir)
     dir -= 1; // Shift zero since not using center direction here.
     if (daisy_a.is_pressed(&daisy_a))
     {
-        wifi_press_multiple(self->daisywheel[dir][0]);
-        wifi_release_multiple_later(self->daisywheel[dir][0], 10);
+        output_press_multiple(self->daisywheel[dir][0]);
+        output_release_multiple_later(self->daisywheel[dir][0], 10);
         daisywheel_used = true;
     }
     else if (daisy_b.is_pressed(&daisy_b))
     {
-        wifi_press_multiple(self->daisywheel[dir][1]);
-        wifi_release_multiple_later(self->daisywheel[dir][1], 10);
+        output_press_multiple(self->daisywheel[dir][1]);
+        output_release_multiple_later(self->daisywheel[dir][1], 10);
         daisywheel_used = true;
     }
     else if (daisy_x.is_pressed(&daisy_x))
     {
-        wifi_press_multiple(self->daisywheel[dir][2]);
-        wifi_release_multiple_later(self->daisywheel[dir][2], 10);
+        output_press_multiple(self->daisywheel[dir][2]);
+        output_release_multiple_later(self->daisywheel[dir][2], 10);
         daisywheel_used = true;
     }
     else if (daisy_y.is_pressed(&daisy_y))
     {
-        wifi_press_multiple(self->daisywheel[dir][3]);
-        wifi_release_multiple_later(self->daisywheel[dir][3], 10);
+        output_press_multiple(self->daisywheel[dir][3]);
+        output_release_multiple_later(self->daisywheel[dir][3], 10);
         daisywheel_used = true;
     }
 }
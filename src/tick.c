@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Tick scheduler of the main loop. The ticks are driven by a hardware alarm set
+to absolute deadlines (start + n * interval), so the cadence does not drift
+with the time the loop itself takes, and the reports go out exactly periodic
+(the host polls at a fixed rate as well).
+
+While waiting, the core sleeps in __wfe(), woken by the alarm or by any other
+interrupt, eg: USB, so the HID reports still queued keep going out (see
+hid_idle()).
+
+If a tick runs over its interval, the missed deadlines are skipped and
+counted, the next tick keeps the phase of the original schedule. The phase
+error (how late a tick starts after its deadline) is measured as well.
+
+With CFG_TICK_SOF_SYNC the schedule is also phase-locked to the USB start of
+frame (SOF): the deadlines are nudged so the reports are ready
+CFG_TICK_SOF_GUARD before the next frame starts, which is when the host polls
+the endpoint, so the samples do not wait for up to a frame before being sent.
+TinyUSB 0.15 (pico-sdk 1.5.1) has no SOF callback, so while idle and mounted
+the core polls the frame number of the controller (SOF_RD) instead of sleeping,
+and timestamps it when it changes. A change seen when the wait starts happened
+while the tick was running and is not used, it would be late. The slack between
+sampling and the next frame is measured as well.
+*/
+
+#include <stdlib.h>
+#include <tusb.h>
+#include <hardware/timer.h>
+#include <hardware/sync.h>
+#include <hardware/structs/usb.h>
+#include "config.h"
+#include "tick.h"
+#include "hid.h"
+#include "common.h"
+
+static uint tick_alarm;
+static volatile bool tick_due = false;
+static uint64_t tick_deadline = 0;
+static uint32_t tick_interval = 0;
+static TickStats stats = {0};
+static uint64_t tick_start = 0;
+static uint16_t sof_frame = 0;  // Last frame number read.
+static uint64_t sof_time = 0;   // Last SOF seen while idle.
+static uint32_t work_max = 0;   // From the tick start to the reports ready, decaying.
+static bool slack_pending = false;
+
+static void tick_alarm_callback(uint alarm)
+{
+    tick_due = true;
+    __sev();
+}
+
+static void tick_schedule()
+{
+    tick_deadline += tick_interval;
+    uint64_t now = time_us_64();
+    if (now >= tick_deadline)
+    {
+        uint32_t behind = (now - tick_deadline) / tick_interval + 1;
+        tick_deadline += (uint64_t)behind * tick_interval;
+        stats.missed += behind;
+    }
+    // Returns true if the deadline passed meanwhile.
+    while (hardware_alarm_set_target(tick_alarm, from_us_since_boot(tick_deadline)))
+    {
+        tick_deadline += tick_interval;
+        stats.missed += 1;
+    }
+}
+
+#if CFG_TICK_SOF_SYNC
+// Nudge the next deadline towards the USB frame phase.
+static void tick_sof_lock()
+{
+    if (!sof_time)
+        return;
+    uint32_t lead = work_max + CFG_TICK_SOF_GUARD;
+    int32_t error = ((int64_t)sof_time - (int64_t)(tick_deadline + lead)) % TICK_USB_FRAME;
+    if (error < -(TICK_USB_FRAME / 2))
+        error += TICK_USB_FRAME;
+    if (error >= (TICK_USB_FRAME / 2))
+        error -= TICK_USB_FRAME;
+    stats.sof_error = error;
+    stats.sof_locked = abs(error) < TICK_SOF_LOCKED;
+    tick_deadline += error / TICK_SOF_GAIN;
+}
+#endif
+
+void tick_init(uint32_t frequency)
+{
+    tick_interval = 1000000 / frequency;
+    tick_alarm = hardware_alarm_claim_unused(true);
+    hardware_alarm_set_callback(tick_alarm, tick_alarm_callback);
+    tick_deadline = time_us_64();
+    tick_schedule();
+}
+
+// The reports of this tick are handed to the USB stack.
+void tick_report_done()
+{
+    uint32_t work = time_us_64() - tick_start;
+    work_max = max(work, work_max - min(work_max, 1));
+    slack_pending = true;
+}
+
+#if CFG_TICK_SOF_SYNC
+// Reading SOF_RD also clears the SOF interrupt flag, TinyUSB does not use it
+// besides remote wakeup.
+static uint16_t tick_sof_read()
+{
+    return usb_hw->sof_rd & USB_SOF_RD_BITS;
+}
+
+// Timestamp the USB start of frame if a new one started.
+static void tick_sof_poll()
+{
+    uint16_t frame = tick_sof_read();
+    if (frame == sof_frame)
+        return;
+    sof_frame = frame;
+    sof_time = time_us_64();
+    if (slack_pending)
+    {
+        uint32_t slack = sof_time - tick_start;
+        stats.slack_max = max(stats.slack_max, slack);
+        stats.slack_avg = smooth(stats.slack_avg, slack, 100);
+        slack_pending = false;
+    }
+}
+#endif
+
+// Sleep until the deadline of the next tick.
+void tick_wait()
+{
+#if CFG_TICK_SOF_SYNC
+    sof_frame = tick_sof_read();
+#endif
+    while (!tick_due)
+    {
+        hid_idle();
+#if CFG_TICK_SOF_SYNC
+        if (tud_mounted())
+        {
+            tick_sof_poll();
+            continue;
+        }
+#endif
+        __wfe();
+    }
+    tick_due = false;
+    tick_start = time_us_64();
+    uint32_t phase = tick_start - tick_deadline;
+    stats.ticks += 1;
+    stats.phase_max = max(stats.phase_max, phase);
+    stats.phase_avg = smooth(stats.phase_avg, phase, 100);
+#if CFG_TICK_SOF_SYNC
+    tick_sof_lock();
+#endif
+    tick_schedule();
+}
+
+TickStats tick_get_stats()
+{
+    return stats;
+}
+
+void tick_reset_stats()
+{
+    stats.phase_max = 0;
+    stats.slack_max = 0;
+}
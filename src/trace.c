@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Binary trace of the frames going through the wireless link, to diagnose the
+link without printing on every frame (which on the stdio UART costs far more
+than the frame itself).
+
+Recording is opt-in with the LOG_WIRELESS log mask. The ring is printed on
+demand (UART key "W" or PROC_TRACE_DUMP from the app), one entry per tick so the
+logging output (UART and WebUSB) is not flooded.
+*/
+
+#include <stdio.h>
+#include "trace.h"
+#include "logging.h"
+#include "uart_esp.h"
+
+static TraceEntry trace[TRACE_LEN];
+static uint16_t trace_head = 0;
+static uint16_t trace_count = 0;
+static uint16_t trace_dump_index = 0;
+static bool trace_dumping = false;
+
+void trace_frame(TraceEvent event, uint16_t sequence, uint8_t flags, uint8_t size)
+{
+    if (!logging_has_mask(LOG_WIRELESS) || trace_dumping)
+        return;
+    TraceEntry *entry = &trace[trace_head & (TRACE_LEN - 1)];
+    entry->time = time_us_32();
+    entry->sequence = sequence;
+    entry->event = event;
+    entry->flags = flags;
+    entry->size = size;
+    entry->queue = uart_esp_tx_pending() / 16;
+    trace_head += 1;
+    if (trace_count < TRACE_LEN)
+        trace_count += 1;
+}
+
+// Start printing the recorded entries, oldest first.
+void trace_dump()
+{
+    if (trace_dumping)
+        return;
+    info("TRACE: %i entries (time event sequence flags size queue)\n", trace_count);
+    trace_dump_index = trace_head - trace_count;
+    trace_dumping = true;
+}
+
+void trace_task()
+{
+    if (!trace_dumping)
+        return;
+    if (trace_dump_index == trace_head)
+    {
+        trace_dumping = false;
+        trace_count = 0;
+        info("TRACE: end\n");
+        return;
+    }
+    TraceEntry *entry = &trace[trace_dump_index & (TRACE_LEN - 1)];
+    info(
+        "TRACE: %lu %s %u %02X %u %u\n",
+        (unsigned long)entry->time,
+        entry->event == TRACE_TX ? "TX" : "RX",
+        entry->sequence,
+        entry->flags,
+        entry->size,
+        entry->queue * 16
+    );
+    trace_dump_index += 1;
+}
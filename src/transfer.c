@@ -1,7 +1,18 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Wireless counterpart of the HID layer. When the output goes to the dongle the
+profile actions are registered here instead (wifi_press, wifi_gamepad_lx...),
+only marking which frame sections changed, and wifi_report() sends them as a
+single frame per tick, see docs/wireless_protocol.md.
+*/
+
 #include <stdio.h>
 #include <string.h>
 #include <pico/time.h>
 #include <hardware/gpio.h>
+#include <hardware/sync.h>
 #include "button.h"
 #include "config.h"
 #include "profile.h"
@@ -10,33 +21,11 @@
 #include "pin.h"
 #include "common.h"
 #include "wifi_sta.h"
+#include "uart_esp.h"
 #include "transfer.h"
 
-// Initializing transfer structure
 transfer_struct transfer = {
-    .wifi_allow_communication = true,   // Initialize wifi allow communication flag
-                                         // (depending upon your specific initialization needs)
-    .synced_keyboard = false,            // Initialize synced keyboard flag
-    .synced_mouse = false,               // Initialize synced mouse flag
-    .synced_gamepad = false,             // Initialize synced gamepad flag
-    .alarms = 0,                         // Initialize alarms to 0 (depending upon your specific initialization needs)
-    .alarm_pool = NULL,                  // Assuming you don't need an alarm pool for this struct initially.
-    .wifi_matrix[256]= {                     // Initialize wifi matrix array with all elements as 0 or the default value of uint8_t
-        0                     // Fill in other values if needed (up to maximum size)
-    },
-    .mouse_x = 0,                        // Initialize mouse x position to 0
-    .mouse_y = 0,                        // Initialize mouse y position to 0.
-    .gamepad_lx = 0.0,                   // Initialize gamepad left x-axis value to 0.0
-    .gamepad_ly = 0.0,                   // Initialize gamepad left y-axis value to 0.0
-    // Similarly initialize other members of the transfer structure...
-    .gamepad_rx = 0.0,
-    .gamepad_ry = 0.0,
-    .gamepad_lz = 0.0,
-    .gamepad_rz = 0.0,
-
-    .gamepad_gyro = {0},   // Assuming this is a custom struct or typedef.
-    .gamepad_accel = {0}  // Assuming this is a custom struct or typedef.
-
+    .wifi_allow_communication = true,
 };
 
 void wifi_matrix_reset(uint8_t keep)
@@ -45,14 +34,35 @@ void wifi_matrix_reset(uint8_t keep)
     {
         if (action == keep)
             continue; // Optionally do not reset specific actions.
-            transfer.wifi_matrix[action] = 0;
+        transfer.wifi_matrix[action] = 0;
     }
-    transfer.synced_keyboard = false;
-    transfer.synced_mouse = false;
-    transfer.synced_gamepad = false;
+    transfer.dirty |= FRAME_FLAG_DIGITAL | FRAME_FLAG_AXES | FRAME_FLAG_MOUSE;
 }
 
+// Frame section that carries the given action.
+uint8_t wifi_section(uint8_t key)
+{
+    if (key == MOUSE_SCROLL_UP || key == MOUSE_SCROLL_DOWN)
+        return FRAME_FLAG_MOUSE;
+    if (wifi_is_axis(key))
+        return FRAME_FLAG_AXES;
+    return FRAME_FLAG_DIGITAL;
+}
 
+// Remember a digital transition, so it is repeated in the next frames and the
+// receiver can recover it even if the frame that carried it is lost.
+static void wifi_history_push(uint8_t key, bool pressed)
+{
+    FrameTransition *transitions = transfer.history.transitions;
+    memmove(transitions, transitions + 1, sizeof(FrameTransition) * (FRAME_HISTORY_LEN - 1));
+    transfer.history_sequence += 1;
+    transitions[FRAME_HISTORY_LEN - 1] = (FrameTransition){
+        .sequence = transfer.history_sequence,
+        .action = key,
+        .pressed = pressed,
+    };
+    transfer.dirty |= FRAME_FLAG_HISTORY;
+}
 
 void wifi_press(uint8_t key)
 {
@@ -62,16 +72,12 @@ void wifi_press(uint8_t key)
         // wifi_procedure_press(key);
     else
     {
-        // 根据 key 的范围更新相应设备的同步标志
+        // 根据 key 的范围标记需要上报的帧段
         transfer.wifi_matrix[key] += 1;
-        if (key >= GAMEPAD_INDEX)
-            transfer.synced_gamepad = false;
-        else if (key >= MOUSE_INDEX)
-            transfer.synced_mouse = false;
-        else
-            transfer.synced_keyboard = false;
+        transfer.dirty |= wifi_section(key);
+        if (transfer.wifi_matrix[key] == 1 && wifi_section(key) == FRAME_FLAG_DIGITAL)
+            wifi_history_push(key, true);
     }
-    sendPacketOverWiFi(transfer);
 }
 
 void wifi_press_multiple(uint8_t *keys)
@@ -100,15 +106,10 @@ void wifi_release(uint8_t key)
         if (transfer.wifi_matrix[key] > 0)
         { // Do not allow to wrap / go negative.
             transfer.wifi_matrix[key] -= 1;
-            if (key >= GAMEPAD_INDEX)
-                transfer.synced_gamepad = false;
-            else if (key >= MOUSE_INDEX)
-                transfer.synced_mouse = false;
-            else
-                transfer.synced_keyboard = false;
-            }
-        sendPacketOverWiFi(transfer);
-
+            transfer.dirty |= wifi_section(key);
+            if (transfer.wifi_matrix[key] == 0 && wifi_section(key) == FRAME_FLAG_DIGITAL)
+                wifi_history_push(key, false);
+        }
     }
 }
 
@@ -132,10 +133,8 @@ void wifi_gamepad_lx(double value)
 {
     if (value == transfer.gamepad_lx)
         return;
-        transfer.gamepad_lx += value; // Multiple inputs can be combined.
-        transfer.synced_gamepad = false;
-        sendPacketOverWiFi(transfer);
-
+    transfer.gamepad_lx += value; // Multiple inputs can be combined.
+    transfer.dirty |= FRAME_FLAG_AXES;
 }
 
 void wifi_gamepad_ly(double value)
@@ -143,49 +142,39 @@ void wifi_gamepad_ly(double value)
     if (value == transfer.gamepad_ly)
         return;
     transfer.gamepad_ly += value; // Multiple inputs can be combined.
-    transfer.synced_gamepad = false;
-    sendPacketOverWiFi(transfer);
-
+    transfer.dirty |= FRAME_FLAG_AXES;
 }
 
 void wifi_gamepad_lz(double value)
 {
     if (value == transfer.gamepad_lz)
         return;
-        transfer.gamepad_lz += value; // Multiple inputs can be combined.
-    transfer.synced_gamepad = false;
-    sendPacketOverWiFi(transfer);
-
+    transfer.gamepad_lz += value; // Multiple inputs can be combined.
+    transfer.dirty |= FRAME_FLAG_AXES;
 }
 
 void wifi_gamepad_rx(double value)
 {
     if (value == transfer.gamepad_rx)
         return;
-        transfer.gamepad_rx += value; // Multiple inputs can be combined.
-    transfer.synced_gamepad = false;
-    sendPacketOverWiFi(transfer);
-
+    transfer.gamepad_rx += value; // Multiple inputs can be combined.
+    transfer.dirty |= FRAME_FLAG_AXES;
 }
 
 void wifi_gamepad_ry(double value)
 {
     if (value == transfer.gamepad_ry)
         return;
-        transfer.gamepad_ry += value; // Multiple inputs can be combined.
-    transfer.synced_gamepad = false;
-    sendPacketOverWiFi(transfer);
-
+    transfer.gamepad_ry += value; // Multiple inputs can be combined.
+    transfer.dirty |= FRAME_FLAG_AXES;
 }
 
 void wifi_gamepad_rz(double value)
 {
     if (value == transfer.gamepad_rz)
         return;
-        transfer.gamepad_rz += value; // Multiple inputs can be combined.
-    transfer.synced_gamepad = false;
-    sendPacketOverWiFi(transfer);
-
+    transfer.gamepad_rz += value; // Multiple inputs can be combined.
+    transfer.dirty |= FRAME_FLAG_AXES;
 }
 
 bool wifi_is_mouse_move(uint8_t key)
@@ -197,9 +186,58 @@ void wifi_mouse_move(int16_t x, int16_t y)
 {
     transfer.mouse_x += x;
     transfer.mouse_y += y;
-    transfer.synced_mouse = false;
-    sendPacketOverWiFi(transfer);
+    transfer.dirty |= FRAME_FLAG_MOUSE;
+}
 
+void wifi_init()
+{
+    // Delayed presses share the alarm pool of the HID layer.
+    transfer.alarm_pool = alarm_pool;
+}
+
+// Delayed actions fire in the alarm IRQ. They are only queued there and applied
+// from the main loop (see wifi_later_apply), so the transfer state (matrix,
+// history and dirty flags) is only ever written from one context.
+typedef struct
+{
+    bool press;
+    uint8_t key;
+    uint8_t *keys;  // Instead of key, for multiple keys.
+} WifiLater;
+
+#define WIFI_LATER_LEN 64  // Power of 2, more than the alarms of a macro.
+
+static WifiLater wifi_later[WIFI_LATER_LEN];
+static volatile uint8_t wifi_later_head = 0;  // Written by the alarm IRQ.
+static volatile uint8_t wifi_later_tail = 0;  // Read by the main loop.
+
+static void wifi_later_push(bool press, uint8_t key, uint8_t *keys)
+{
+    uint8_t head = wifi_later_head;
+    if ((uint8_t)(head - wifi_later_tail) >= WIFI_LATER_LEN)
+        return;
+    wifi_later[head % WIFI_LATER_LEN] = (WifiLater){press, key, keys};
+    __compiler_memory_barrier();
+    wifi_later_head = head + 1;
+}
+
+static void wifi_later_apply()
+{
+    while (wifi_later_tail != wifi_later_head)
+    {
+        WifiLater later = wifi_later[wifi_later_tail % WIFI_LATER_LEN];
+        __compiler_memory_barrier();
+        wifi_later_tail += 1;
+        if (later.keys && later.press)
+            wifi_press_multiple(later.keys);
+        else if (later.keys)
+            wifi_release_multiple(later.keys);
+        else if (later.press)
+            wifi_press(later.key);
+        else
+            wifi_release(later.key);
+        transfer.alarms--;
+    }
 }
 
 void wifi_press_later(uint8_t key, uint16_t delay)
@@ -221,8 +259,8 @@ void wifi_release_later(uint8_t key, uint16_t delay)
         (alarm_callback_t)wifi_release_later_callback,
         (void *)(uint32_t)key,
         true);
-        transfer.alarms++;
-    }
+    transfer.alarms++;
+}
 
 void wifi_press_multiple_later(uint8_t *keys, uint16_t delay)
 {
@@ -232,8 +270,8 @@ void wifi_press_multiple_later(uint8_t *keys, uint16_t delay)
         (alarm_callback_t)wifi_press_multiple_later_callback,
         keys,
         true);
-        transfer.alarms++;
-    }
+    transfer.alarms++;
+}
 
 void wifi_release_multiple_later(uint8_t *keys, uint16_t delay)
 {
@@ -243,41 +281,31 @@ void wifi_release_multiple_later(uint8_t *keys, uint16_t delay)
         (alarm_callback_t)wifi_release_multiple_later_callback,
         keys,
         true);
-        transfer.alarms++;
-    }
+    transfer.alarms++;
+}
 
 void wifi_press_later_callback(alarm_id_t alarm, uint8_t key)
 {
     alarm_pool_cancel_alarm(transfer.alarm_pool, alarm);
-    wifi_press(key);
-    transfer.alarms++;
+    wifi_later_push(true, key, NULL);
 }
 
 void wifi_release_later_callback(alarm_id_t alarm, uint8_t key)
 {
     alarm_pool_cancel_alarm(transfer.alarm_pool, alarm);
-    wifi_release(key);
-    transfer.alarms++;
-    sendPacketOverWiFi(transfer);
-
+    wifi_later_push(false, key, NULL);
 }
 
 void wifi_press_multiple_later_callback(alarm_id_t alarm, uint8_t *keys)
 {
     alarm_pool_cancel_alarm(transfer.alarm_pool, alarm);
-    wifi_press_multiple(keys);
-    transfer.alarms++;
-    sendPacketOverWiFi(transfer);
-
+    wifi_later_push(true, 0, keys);
 }
 
 void wifi_release_multiple_later_callback(alarm_id_t alarm, uint8_t *keys)
 {
     alarm_pool_cancel_alarm(transfer.alarm_pool, alarm);
-    wifi_release_multiple(keys);
-    transfer.alarms++;
-    sendPacketOverWiFi(transfer);
-
+    wifi_later_push(false, 0, keys);
 }
 
 void wifi_macro(uint8_t index)
@@ -319,12 +347,7 @@ void wifi_gamepad_gyro(double x, double y, double z)
         b = true;
     }
     if (b)
-    {
-        transfer.synced_gamepad = false;
-        // synced_gamepad_gyroscope = false;
-    };
-    sendPacketOverWiFi(transfer);
-
+        transfer.dirty |= FRAME_FLAG_GYRO;
 }
 
 void wifi_gamepad_accel(double x, double y, double z)
@@ -346,10 +369,158 @@ void wifi_gamepad_accel(double x, double y, double z)
         b = true;
     }
     if (b)
+        transfer.dirty |= FRAME_FLAG_ACCEL;
+}
+
+// IMU samples not sent yet, see wifi_gamepad_motion().
+static FrameMotionSample motion_samples[FRAME_MOTION_LEN];
+static uint32_t motion_times[FRAME_MOTION_LEN];
+static uint8_t motion_len = 0;
+
+// Queue an IMU sample for the motion batch, every call is a sample. If the
+// link does not keep up the oldest samples are dropped.
+void wifi_gamepad_motion(Vector gyro, Vector accel)
+{
+    if (motion_len == FRAME_MOTION_LEN)
     {
-        transfer.synced_gamepad = false;
-        // synced_gamepad_gyroscope = false;
+        memmove(motion_samples, motion_samples + 1, sizeof(FrameMotionSample) * (FRAME_MOTION_LEN - 1));
+        memmove(motion_times, motion_times + 1, sizeof(uint32_t) * (FRAME_MOTION_LEN - 1));
+        motion_len -= 1;
+    }
+    motion_samples[motion_len] = (FrameMotionSample){
+        .gyro = {frame_quantize(gyro.x, 1), frame_quantize(gyro.y, 1), frame_quantize(gyro.z, 1)},
+        .accel = {frame_quantize(accel.x, 1), frame_quantize(accel.y, 1), frame_quantize(accel.z, 1)},
     };
-    sendPacketOverWiFi(transfer);
+    motion_times[motion_len] = time_us_32();
+    motion_len += 1;
+}
 
+// Move the queued samples into the frame, aged relative to the frame time.
+static void wifi_motion_take(FrameMotion *motion, uint32_t now)
+{
+    motion->len = motion_len;
+    for (uint8_t i = 0; i < motion_len; i++)
+    {
+        motion->samples[i] = motion_samples[i];
+        motion->samples[i].age = min(now - motion_times[i], UINT16_MAX);
+    }
+    motion_len = 0;
+}
+
+// Values that are accumulated during a tick start again from zero, the same
+// way the HID layer does after each report.
+void wifi_tick_reset()
+{
+    if (transfer.gamepad_lx || transfer.gamepad_ly ||
+        transfer.gamepad_rx || transfer.gamepad_ry ||
+        transfer.gamepad_lz || transfer.gamepad_rz)
+    {
+        // An axis not reported next tick is back at zero, compare it then.
+        transfer.dirty |= FRAME_FLAG_AXES;
+    }
+    transfer.gamepad_lx = 0;
+    transfer.gamepad_ly = 0;
+    transfer.gamepad_rx = 0;
+    transfer.gamepad_ry = 0;
+    transfer.gamepad_lz = 0;
+    transfer.gamepad_rz = 0;
+    transfer.mouse_x = 0;
+    transfer.mouse_y = 0;
+    transfer.wifi_matrix[MOUSE_SCROLL_UP] = 0;
+    transfer.wifi_matrix[MOUSE_SCROLL_DOWN] = 0;
+}
+
+// Sections sent after (re)connecting, the receiver state is unknown.
+#define WIFI_FRAME_RESYNC (FRAME_FLAGS_STATE & ~FRAME_FLAG_MOUSE)
+
+// Sections that change continuously.
+#define WIFI_FRAME_MOTION (FRAME_FLAG_AXES | FRAME_FLAG_MOUSE)
+
+// IMU values travel in the motion batch, their sections are only sent to
+// resync (and on UDP with every frame).
+#define WIFI_FRAME_IMU (FRAME_FLAG_GYRO | FRAME_FLAG_ACCEL)
+
+// Sections sent in every frame. Datagrams may be lost or arrive out of order,
+// so on UDP every frame carries the whole state and supersedes the previous.
+#if CFG_WIFI_TRANSPORT == WIFI_TRANSPORT_UDP
+#define WIFI_FRAME_ALWAYS WIFI_FRAME_RESYNC
+#else
+#define WIFI_FRAME_ALWAYS 0
+#endif
+
+// Add up mouse movement that could not be sent yet.
+static void wifi_mouse_add(FrameMouse *pending, const FrameMouse *mouse)
+{
+    pending->x = constrain(pending->x + mouse->x, -32767, 32767);
+    pending->y = constrain(pending->y + mouse->y, -32767, 32767);
+    pending->scroll = constrain(pending->scroll + mouse->scroll, -127, 127);
+}
+
+// Called once per tick after all inputs were evaluated. Sends at most one
+// frame, with only the sections that differ from what the receiver has.
+//
+// Rate control:
+// - Digital transitions are sent right away.
+// - Motion (axes, mouse) is sent every tick while moving, as long as the link
+//   keeps up, otherwise it waits (mouse movement adds up).
+// - IMU samples are batched, a frame is sent when FRAME_MOTION_LEN samples are
+//   queued, and any frame sent earlier takes the samples queued so far.
+// - When nothing changes a heartbeat frame is sent every
+//   CFG_WIFI_HEARTBEAT_INTERVAL, so the receiver can tell an idle controller
+//   from a lost link.
+// - When motion stops a heartbeat is sent right away, so the receiver knows
+//   the values settled and does not extrapolate them (see playout.c).
+void wifi_report()
+{
+    static Frame sent = {0};
+    static Frame frame;
+    static FrameMouse mouse = {0};
+    static bool connected = false;
+    static uint32_t last_sent = 0;
+    static bool moving = false;
+    wifi_later_apply();
+    // The receiver state is unknown after (re)connecting, send all of it.
+    bool resync = false;
+    if (wifi_is_connected() != connected)
+    {
+        connected = !connected;
+        resync = connected;
+        if (resync)
+            transfer.dirty |= FRAME_FLAGS_STATE;
+    }
+    uint32_t now = time_us_32();
+    bool heartbeat = (now - last_sent) >= (CFG_WIFI_HEARTBEAT_INTERVAL * 1000);
+    bool batch = motion_len == FRAME_MOTION_LEN;
+    if ((transfer.dirty || heartbeat || moving || batch) && transfer.wifi_allow_communication && connected)
+    {
+        wifi_frame_from_transfer(&transfer, &frame);
+        wifi_mouse_add(&mouse, &frame.mouse);
+        frame.mouse = mouse;
+        uint8_t changes = frame_changes(&sent, &frame) & ~WIFI_FRAME_IMU;
+        if (moving && !(changes & WIFI_FRAME_MOTION))
+            heartbeat = true;
+        bool busy = uart_esp_tx_pending() > CFG_WIFI_BACKLOG_LIMIT;
+        if (resync || heartbeat || (changes & FRAME_FLAG_DIGITAL) || ((changes || batch) && !busy))
+        {
+            frame.header.flags = changes | (resync ? WIFI_FRAME_RESYNC : WIFI_FRAME_ALWAYS);
+            frame.header.time = now;
+            if (motion_len)
+            {
+                frame.header.flags |= FRAME_FLAG_MOTION;
+                wifi_motion_take(&frame.motion, now);
+            }
+            sendPacketOverWiFi(&frame);
+            moving = changes & WIFI_FRAME_MOTION;
+            frame_merge(&sent, &frame);
+            memset(&mouse, 0, sizeof(FrameMouse));
+            last_sent = now;
+            transfer.dirty = 0;
+        }
+        else
+        {
+            // Try again next tick.
+            transfer.dirty = changes;
+        }
+    }
+    wifi_tick_reset();
 }
@@ -8,6 +8,8 @@
 #include "config.h"
 #include "self_test.h"
 #include "logging.h"
+#include "trace.h"
+#include "wifi_sta.h"
 
 void uart_listen_char_do(bool limited)
 {
@@ -53,6 +55,16 @@ void uart_listen_char_do(bool limited)
         info("UART: Self-test\n");
         self_test();
     }
+    if (input == 'W')
+    {
+        info("UART: Wireless trace\n");
+        trace_dump();
+    }
+    if (input == 'L')
+    {
+        info("UART: Wireless link\n");
+        wifi_stats_print();
+    }
 }
 
 void uart_listen_char(uint16_t loop_index)
@@ -1,31 +1,271 @@
 // SPDX-License-Identifier: GPL-2.0-only
 // Copyright (C) 2022, Input Labs Oy.
 
+/*
+Bytes for the ESP8285 are written into a ring buffer that is drained by a DMA
+channel paced by the UART TX DREQ, so the send path never waits for the link.
+
+A message is written with one or more uart_esp_tx_enqueue() and published with
+uart_esp_tx_commit(). If a message does not fit in the ring it is dropped as a
+whole, so the ESP never receives partial frames.
+
+Bytes from the ESP8285 are moved by the UART RX IRQ into another ring buffer,
+which the main loop drains with uart_esp_rx_read() without ever waiting.
+*/
+
 #include <stdio.h>
 #include <pico/bootrom.h>
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
+#include <hardware/dma.h>
+#include <hardware/irq.h>
+#include <hardware/sync.h>
 
 #include <hardware/watchdog.h>
 #include "config.h"
 #include "self_test.h"
 #include "logging.h"
+#include "common.h"
 #include "uart_esp.h"
+#include "pin.h"
 
-#include "pico/stdlib.h"
-#include "hardware/uart.h"
+// uart0 only has RTS/CTS on GPIO2/3, 14/15 or 18/19, which the controller uses
+// for the LEDs, the I2C bus and the SPI chip selects.
+#if CFG_WIFI_UART_FLOW_CONTROL && (UART_CTS_PIN == PIN_LED_UP || UART_RTS_PIN == PIN_LED_LEFT)
+#error "CFG_WIFI_UART_FLOW_CONTROL: the RTS/CTS pins are the LED pins (GPIO2/GPIO3)"
+#endif
+
+#define UART_TX_RING_MASK (UART_TX_RING_SIZE - 1)
+
+// Indexes are free running, the ring position is the index masked.
+static uint8_t tx_ring[UART_TX_RING_SIZE];
+static volatile uint16_t tx_head = 0;  // Committed by the main loop.
+static volatile uint16_t tx_tail = 0;  // Sent, advanced by the DMA IRQ.
+static volatile uint16_t tx_inflight = 0;
+static uint16_t tx_staged = 0;  // Enqueued but not committed yet.
+static bool tx_staged_overflow = false;
+static int tx_channel = -1;
+static UartTxStats tx_stats = {0};
+
+// Start a transfer for the next contiguous chunk of the ring, if idle.
+// Must not be preempted by the DMA IRQ.
+static void uart_esp_tx_start()
+{
+    if (tx_inflight || tx_head == tx_tail)
+        return;
+    uint16_t index = tx_tail & UART_TX_RING_MASK;
+    uint16_t pending = tx_head - tx_tail;
+    uint16_t contiguous = UART_TX_RING_SIZE - index;
+    tx_inflight = min(pending, contiguous);
+    dma_channel_transfer_from_buffer_now(tx_channel, &tx_ring[index], tx_inflight);
+}
+
+static void uart_esp_tx_irq()
+{
+    if (!dma_channel_get_irq0_status(tx_channel))
+        return;
+    dma_channel_acknowledge_irq0(tx_channel);
+    tx_tail += tx_inflight;
+    tx_inflight = 0;
+    uart_esp_tx_start();
+}
+
+void uart_esp_tx_init()
+{
+    tx_channel = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(tx_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, uart_get_dreq(UART_ID, true));
+    dma_channel_configure(
+        tx_channel,
+        &config,
+        &uart_get_hw(UART_ID)->dr,
+        tx_ring,
+        0,
+        false
+    );
+    dma_channel_set_irq0_enabled(tx_channel, true);
+    irq_add_shared_handler(
+        DMA_IRQ_0,
+        uart_esp_tx_irq,
+        PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY
+    );
+    irq_set_enabled(DMA_IRQ_0, true);
+    info("ESP: TX ring %i bytes on DMA channel %i\n", UART_TX_RING_SIZE, tx_channel);
+}
+
+// Copy data at the end of the message being written. Returns false if the
+// message does not fit, in which case the whole message is dropped on commit.
+bool uart_esp_tx_enqueue(const uint8_t *data, uint16_t len)
+{
+    if (tx_staged_overflow)
+        return false;
+    uint16_t used = tx_staged - tx_tail;
+    if (len > UART_TX_RING_SIZE - used)
+    {
+        tx_staged_overflow = true;
+        return false;
+    }
+    for (uint16_t i = 0; i < len; i++)
+    {
+        tx_ring[(tx_staged + i) & UART_TX_RING_MASK] = data[i];
+    }
+    tx_staged += len;
+    return true;
+}
+
+// Publish the message written so far and start sending it.
+bool uart_esp_tx_commit()
+{
+    if (tx_staged_overflow)
+    {
+        tx_staged = tx_head;
+        tx_staged_overflow = false;
+        tx_stats.overflows += 1;
+        return false;
+    }
+    if (tx_staged == tx_head)
+        return true;
+    tx_stats.bytes += (uint16_t)(tx_staged - tx_head);
+    tx_stats.commits += 1;
+    tx_head = tx_staged;
+    uint16_t used = tx_head - tx_tail;
+    if (used > tx_stats.high_water)
+        tx_stats.high_water = used;
+    if (tx_channel >= 0)
+    {
+        uint32_t interrupts = save_and_disable_interrupts();
+        uart_esp_tx_start();
+        restore_interrupts(interrupts);
+    }
+    return true;
+}
+
+// Bytes committed but not sent yet.
+uint16_t uart_esp_tx_pending()
+{
+    return tx_head - tx_tail;
+}
+
+// Block until everything committed is out of the UART, needed before writing
+// to the UART directly (eg: AT commands).
+void uart_esp_tx_wait()
+{
+    if (tx_channel < 0)
+        return;
+    while (tx_head != tx_tail)
+        tight_loop_contents();
+    uart_tx_wait_blocking(UART_ID);
+}
+
+// Everything committed is out of the UART, it is safe to change the baudrate.
+bool uart_esp_tx_idle()
+{
+    if (tx_channel < 0)
+        return true;
+    return tx_head == tx_tail && !(uart_get_hw(UART_ID)->fr & UART_UARTFR_BUSY_BITS);
+}
+
+UartTxStats uart_esp_tx_stats()
+{
+    return tx_stats;
+}
+
+#define UART_RX_RING_MASK (UART_RX_RING_SIZE - 1)
+#define UART_DR_OVERRUN_BIT 0x800
+#define UART_DR_ERROR_BITS 0x700  // Break, parity and framing.
+
+static uint8_t rx_ring[UART_RX_RING_SIZE];
+static volatile uint16_t rx_head = 0;  // Written by the UART IRQ.
+static volatile uint16_t rx_tail = 0;  // Read by the main loop.
+static volatile UartRxStats rx_stats = {0};
+static volatile uint32_t rx_timestamp = 0;  // Microseconds, last byte received.
+
+static void uart_esp_rx_irq()
+{
+    while (uart_is_readable(UART_ID))
+    {
+        uint32_t data = uart_get_hw(UART_ID)->dr;
+        if (data & UART_DR_OVERRUN_BIT)
+            rx_stats.overruns += 1;
+        if (data & UART_DR_ERROR_BITS)
+            rx_stats.errors += 1;
+        if ((uint16_t)(rx_head - rx_tail) >= UART_RX_RING_SIZE)
+        {
+            rx_stats.overflows += 1;
+            continue;
+        }
+        rx_ring[rx_head & UART_RX_RING_MASK] = data & 0xFF;
+        rx_head += 1;
+        rx_stats.bytes += 1;
+        rx_timestamp = time_us_32();
+    }
+}
+
+void uart_esp_rx_init()
+{
+    uint irq = uart_get_index(UART_ID) ? UART1_IRQ : UART0_IRQ;
+    irq_set_exclusive_handler(irq, uart_esp_rx_irq);
+    irq_set_enabled(irq, true);
+    uart_set_irq_enables(UART_ID, true, false);
+}
+
+// Copy up to len received bytes into data. Returns the number of bytes copied.
+uint16_t uart_esp_rx_read(uint8_t *data, uint16_t len)
+{
+    uint16_t count = 0;
+    while (count < len && rx_tail != rx_head)
+    {
+        data[count++] = rx_ring[rx_tail & UART_RX_RING_MASK];
+        rx_tail += 1;
+    }
+    return count;
+}
+
+UartRxStats uart_esp_rx_stats()
+{
+    return rx_stats;
+}
 
-#define UART_ID uart0
-#define BAUD_RATE 115200
-#define DATA_BITS 8
-#define STOP_BITS 1
-#define PARITY    UART_PARITY_NONE
+// Time when the last byte was received, to measure the age of the data.
+uint32_t uart_esp_rx_timestamp()
+{
+    return rx_timestamp;
+}
+
+static uint32_t baudrate = 0;
+static bool flow_control = false;
 
-#define UART_TX_PIN 0
-#define UART_RX_PIN 1
+// Change the local side of the link, the ESP must be switched first (see
+// AT+UART_CUR in wifi_sta.c). Returns the actual baudrate.
+uint32_t uart_esp_set_baudrate(uint32_t requested, bool flow)
+{
+    uart_esp_tx_wait();
+    baudrate = uart_set_baudrate(UART_ID, requested);
+    if (flow && !flow_control)
+    {
+        gpio_set_function(UART_CTS_PIN, GPIO_FUNC_UART);
+        gpio_set_function(UART_RTS_PIN, GPIO_FUNC_UART);
+    }
+    uart_set_hw_flow(UART_ID, flow, flow);
+    flow_control = flow;
+    return baudrate;
+}
+
+uint32_t uart_esp_get_baudrate()
+{
+    return baudrate;
+}
+
+bool uart_esp_get_flow_control()
+{
+    return flow_control;
+}
 
 void init_uart() {
-    uart_init(UART_ID, BAUD_RATE);
+    baudrate = uart_init(UART_ID, BAUD_RATE);
 
     gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
@@ -33,9 +273,7 @@ void init_uart() {
     // uart_set_hw_flow(UART_ID, false, false);
     // uart_set_format(UART_ID, DATA_BITS, STOP_BITS, PARITY);
 
-    uart_puts(UART_ID, "+++");
-    sleep_ms(1000);
-    while (uart_is_readable(UART_ID))
-        uart_getc(UART_ID);
-    sleep_ms(2000);
+    // Leaving transparent mode ("+++") is done by the AT sequence in wifi_sta.c.
+    uart_esp_tx_init();
+    uart_esp_rx_init();
 }
@@ -14,6 +14,7 @@
 #include "common.h"
 #include "logging.h"
 #include "transfer.h"
+#include "trace.h"
 
 char webusb_buffer[WEBUSB_BUFFER_SIZE] = {
     0,
@@ -24,6 +25,7 @@ bool webusb_timedout = false;
 
 static bool webusb_pending_empty = false;
 static bool webusb_pending_status_share = false;
+static bool webusb_pending_wireless_share = false;
 static uint8_t webusb_pending_config_share = 0;
 static uint8_t webusb_pending_profile_share = 0;
 static uint8_t webusb_pending_section_share = 0;
@@ -80,6 +82,7 @@ bool webusb_flush()
     if (
         webusb_ptr_in == 0 &&
         !webusb_pending_status_share &&
+        !webusb_pending_wireless_share &&
         !webusb_pending_config_share &&
         !webusb_pending_profile_share &&
         !webusb_pending_section_share)
@@ -104,6 +107,13 @@ bool webusb_flush()
         if (sent)
             webusb_pending_status_share = false;
     }
+    else if (webusb_pending_wireless_share)
+    {
+        ctrl = ctrl_wireless_share();
+        bool sent = webusb_transfer(ctrl);
+        if (sent)
+            webusb_pending_wireless_share = false;
+    }
     else if (webusb_pending_config_share)
     {
         ctrl = ctrl_config_share(webusb_pending_config_share);
@@ -183,6 +193,12 @@ static void webusb_handle_status_set(uint8_t time[8])
     // set_system_clock(*(uint64_t*)time);  // TODO: Backport from other branch.
 }
 
+static void webusb_handle_wireless_get()
+{
+    debug("WebUSB: Received wireless GET from app\n");
+    webusb_pending_wireless_share = true;
+}
+
 static void webusb_handle_proc(uint8_t proc)
 {
     if (proc == PROC_RESTART)
@@ -197,6 +213,8 @@ static void webusb_handle_proc(uint8_t proc)
         config_reset_config();
     else if (proc == PROC_RESET_PROFILES)
         config_reset_profiles();
+    else if (proc == PROC_TRACE_DUMP)
+        trace_dump();
 }
 
 static void webusb_handle_config_get(Ctrl_cfg_type key)
@@ -245,6 +263,8 @@ void webusb_read()
         webusb_handle_status_get();
     if (ctrl.message_type == STATUS_SET)
         webusb_handle_status_set(ctrl.payload);
+    if (ctrl.message_type == WIRELESS_GET)
+        webusb_handle_wireless_get();
     if (ctrl.message_type == CONFIG_GET)
         webusb_handle_config_get(ctrl.payload[0]);
     if (ctrl.message_type == CONFIG_SET)
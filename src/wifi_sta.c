@@ -3,6 +3,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <math.h>
 #include "stdbool.h"
 #include "uart_esp.h"
 #include "uart.h"
@@ -11,6 +12,13 @@
 #include "transfer.h"
 #include "vector.h"
 #include "switch_pro.h"
+#include "frame.h"
+#include "hid.h"
+#include "common.h"
+#include "config.h"
+#include "logging.h"
+#include "trace.h"
+#include "playout.h"
 
 // char SSID[] = "HUAWEI-CR18QS";
 char SSID[] = "OnePlus Ace 3";
@@ -21,487 +29,1023 @@ char Port[] = "8080";
 // char response[256];
 // char ip_address[16];  // 足够存储常见的IP地址格式
 char buf[256] = {0};
-char uart_command[50] = "";
+char uart_command_join[128] = "";
+char uart_command_address[96] = "";
+char uart_command_start[96] = "";
+char uart_command_baudrate[48] = "";
 // int port;
 
-// 定义全局变量
-bool hid_allow_communication = true;
-bool synced_keyboard = false;
-bool synced_mouse = false;
-bool synced_gamepad = false;
+/*
+AT commands are run by a state machine ticked from the main loop, so the rest
+of the controller (USB, sticks, buttons) is live while the ESP associates.
 
-uint16_t alarms = 0;
-alarm_pool_t *alarm_pool;
+Each step sends a command and waits for the expected response, a step fails on
+"ERROR", "FAIL" or timeout and it is retried. If a step runs out of retries the
+whole sequence starts again after CFG_WIFI_RETRY_DELAY.
 
-uint8_t state_matrix[256] = {
-    0,
-};
-
-int16_t mouse_x = 0;
-int16_t mouse_y = 0;
+The dongle build (DONGLE) runs the same sequence, but instead of connecting to
+the receiver it listens on Port, see docs/wireless_protocol.md.
 
-double gamepad_lx = 0;
-double gamepad_ly = 0;
-double gamepad_rx = 0;
-double gamepad_ry = 0;
-double gamepad_lz = 0;
-double gamepad_rz = 0;
+The UART starts at the default 115200 baud and is switched to
+CFG_WIFI_UART_BAUDRATE with AT+UART_CUR (not persisted by the ESP). The new
+rate is verified, and if the link does not work at it both sides go back to the
+default rate. If the ESP does not answer the first AT at all, it may be left at
+another rate, and the restart of the sequence probes the next known rate. The
+local rate is only changed once the UART is idle, waiting across ticks.
 
-Vector gamepad_gyro = 0;
-Vector gamepad_accel = 0;
+The last good association (BSSID, channel and address) is kept in the config
+block. When it is valid the sequence first tries a fast reconnect: static
+address (no DHCP) and join with the BSSID (no full scan). If the join fails the
+cache is cleared and the sequence continues with a regular join and DHCP.
 
-SwitchProUsb switchProUsb;
+While connected the link is watched, and if it is lost (the ESP reports the
+disconnection, the TX ring stays stalled, or the receiver stops asking for clock
+sync) the sequence starts again, without blocking the main loop.
+*/
 
+typedef enum _WifiState
+{
+    WIFI_STATE_IDLE,
+    WIFI_STATE_SEND,
+    WIFI_STATE_WAIT,
+    WIFI_STATE_RETRY_DELAY,
+    WIFI_STATE_BAUDRATE,
+    WIFI_STATE_CONNECTED,
+} WifiState;
 
-bool sendCMD(const char *cmd, const char *act)
+typedef struct
 {
-    int i = 0;
-    uint64_t t = 0;
+    const char *command;   // NULL to only wait.
+    const char *response;  // NULL to succeed when the timeout passes.
+    bool raw;              // Do not terminate the command with CRLF.
+    uint16_t timeout;      // Milliseconds.
+    uint8_t retries;
+    bool probe;            // The response time is the ESP latency (quick command).
+    void (*completed)();   // Optional, called when the step succeeds.
+    void (*failed)();      // Optional, called instead of restarting the sequence.
+} AtStep;
 
-    uart_puts(UART_ID, cmd);
-    uart_puts(UART_ID, "\r\n");
+static void wifi_handshake_failed();
+static void wifi_baudrate_apply();
+static void wifi_baudrate_keep();
+static void wifi_baudrate_fallback();
+static void wifi_join_failed();
+static void wifi_association_read();
+static void wifi_address_read();
+static void wifi_link_reset();
 
-    t = time_us_64();
-    while (time_us_64() - t < 2500 * 1000)
+static const AtStep steps[] = {
+    // Leave transparent mode, "+++" needs 1 second of silence around it.
+    {.command=NULL, .timeout=1000},
+    {.command="+++", .raw=true, .timeout=1000},
+    {.command="AT", .response="OK", .timeout=500, .retries=3, .probe=true, .failed=wifi_handshake_failed},
+    // Switch to the fast baudrate and verify it.
     {
-        while (uart_is_readable_within_us(UART_ID, 2000))
-        {
-            buf[i++] = uart_getc(UART_ID);
-        }
-        if (i > 0)
-        {
-            buf[i] = '\0';
-            printf("%s\r\n", buf);
-            if (strstr(buf, act) != NULL)
-            {
-                return true;
-            }
-            else
-            {
-                i = 0;
-            }
-        }
+        .command=uart_command_baudrate,
+        .response="OK",
+        .timeout=500,
+        .completed=wifi_baudrate_apply,
+        .failed=wifi_baudrate_keep,
+    },
+    {
+        .command="AT",
+        .response="OK",
+        .timeout=200,
+        .retries=3,
+        .probe=true,
+        .failed=wifi_baudrate_fallback,
+    },
+    // Connect.
+    {.command="AT+CWMODE=3", .response="OK", .timeout=500, .retries=3},
+    {.command=uart_command_address, .response="OK", .timeout=500, .retries=3},
+    {.command=uart_command_join, .response="OK", .timeout=15000, .retries=2, .failed=wifi_join_failed},
+    // Read back the association for the next fast reconnect.
+    {
+        .command="AT+CWJAP_CUR?",
+        .response="OK",
+        .timeout=500,
+        .retries=2,
+        .probe=true,
+        .completed=wifi_association_read,
+    },
+    {.command="AT+CIPSTA_CUR?", .response="OK", .timeout=500, .retries=2, .completed=wifi_address_read},
+    {.command="AT+CIFSR", .response="OK", .timeout=1000, .retries=2},
+#if DONGLE
+    // Listen for the controller, data arrives as "+IPD" messages.
+#if CFG_WIFI_TRANSPORT == WIFI_TRANSPORT_TCP
+    {.command="AT+CIPMUX=1", .response="OK", .timeout=500, .retries=3},
+#endif
+    {.command=uart_command_start, .response="OK", .timeout=5000, .retries=3},
+#else
+    {.command=uart_command_start, .response="OK", .timeout=5000, .retries=3},
+    {.command="AT+CIPMODE=1", .response="OK", .timeout=500, .retries=3},
+    {.command="AT+CIPSEND", .response=">", .timeout=1000, .retries=3},
+#endif
+};
+
+// Rates the ESP may be left at, probed in order when the sequence restarts.
+static const uint32_t baudrates[] = {BAUD_RATE, CFG_WIFI_UART_BAUDRATE};
+
+#define AT_STEPS_LEN (sizeof(steps) / sizeof(AtStep))
+
+static WifiState wifi_state = WIFI_STATE_IDLE;
+static uint8_t wifi_step = 0;
+static uint8_t wifi_attempt = 0;
+static uint16_t wifi_received = 0;
+static uint32_t wifi_timestamp = 0;  // Milliseconds, start of the current wait.
+static uint32_t wifi_connect_start = 0;
+static uint8_t wifi_probe = 0;
+static bool wifi_probe_next = false;  // No answer to the handshake, try the next rate.
+static bool wifi_timed_out = false;   // The last failed step got no response.
+static uint32_t wifi_baudrate = 0;    // Requested, applied once the UART is idle.
+static bool wifi_flow_control = false;
+static bool wifi_fast = false;  // Reconnecting with the cached association.
+static uint8_t wifi_bssid[6];
+static uint8_t wifi_channel = 0;
+static bool wifi_bssid_valid = false;
+static WifiStats wifi_stats = {0};
+static uint16_t wifi_frames = 0;  // Sent since the last stats refresh.
+
+static uint32_t wifi_now()
+{
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static void wifi_step_failed(const char *reason)
+{
+    const AtStep *step = &steps[wifi_step];
+    wifi_attempt += 1;
+    if (wifi_attempt <= step->retries)
+    {
+        wifi_state = WIFI_STATE_SEND;
+        return;
+    }
+    warn("WIFI: %s failed (%s)\n", step->command, reason);
+    wifi_timed_out = !strcmp(reason, "timeout");
+    if (step->failed)
+    {
+        wifi_attempt = 0;
+        step->failed();
+        return;
     }
-    //printf("false\r\n");
-    return false;
+    wifi_state = WIFI_STATE_RETRY_DELAY;
+    wifi_timestamp = wifi_now();
 }
 
-void connectToWifi() {
-    sendCMD("AT", "OK");
-    sendCMD("AT+CWMODE=3", "OK");
-    sprintf(uart_command, "AT+CWJAP=\"%s\",\"%s\"", SSID, password);
-    sendCMD(uart_command, "OK");
+static void wifi_step_completed()
+{
+    if (steps[wifi_step].probe)
+        wifi_stats.at_latency = wifi_now() - wifi_timestamp;
+    if (steps[wifi_step].completed)
+        steps[wifi_step].completed();
+    wifi_step += 1;
+    wifi_attempt = 0;
+    if (wifi_step < AT_STEPS_LEN)
+    {
+        // Unless a baudrate change has to complete first.
+        if (wifi_state != WIFI_STATE_BAUDRATE)
+            wifi_state = WIFI_STATE_SEND;
+        return;
+    }
+    wifi_state = WIFI_STATE_CONNECTED;
+    wifi_link_reset();
+    UartRxStats rx = uart_esp_rx_stats();
+    info(
+        "WIFI: Connected in %lu ms (%s)\n",
+        (unsigned long)(wifi_now() - wifi_connect_start),
+        wifi_fast ? "fast reconnect" : "full association"
+    );
+    info(
+        "WIFI: UART %lu baud, flow control %s, overruns=%lu errors=%lu\n",
+        (unsigned long)uart_esp_get_baudrate(),
+        uart_esp_get_flow_control() ? "on" : "off",
+        (unsigned long)rx.overruns,
+        (unsigned long)rx.errors
+    );
+}
 
-    led_blink_ms(2000);
-    // Uncomment to get the IP address of the ESP
-    sendCMD("AT+CIFSR", "OK"); // ASK IP
+// Change the local rate once everything queued is sent at the current one,
+// then send the current step. See wifi_sta_task().
+static void wifi_baudrate_switch(uint32_t baudrate, bool flow_control)
+{
+    wifi_baudrate = baudrate;
+    wifi_flow_control = flow_control;
+    wifi_state = WIFI_STATE_BAUDRATE;
+}
 
-    led_blink_ms(2000);
+// Only a handshake without any answer means the rate is wrong, other failures
+// restart the sequence at the same rate.
+static void wifi_handshake_failed()
+{
+    wifi_probe_next = wifi_timed_out;
+    wifi_state = WIFI_STATE_RETRY_DELAY;
+    wifi_timestamp = wifi_now();
+}
 
-    sprintf(uart_command, "AT+CIPSTART=\"TCP\",\"%s\",%s", ServerIP, Port);
-    sendCMD(uart_command, "OK");
-    led_blink_ms(2000);
+// The ESP answered OK at the old rate and switched, follow it.
+static void wifi_baudrate_apply()
+{
+    wifi_baudrate_switch(CFG_WIFI_UART_BAUDRATE, CFG_WIFI_UART_FLOW_CONTROL);
+}
 
-    // Send data
-    sendCMD("AT+CIPMODE=1", "OK");
-    led_blink_ms(1000);
+// The ESP does not support the command, verify the link at the current rate.
+static void wifi_baudrate_keep()
+{
+    wifi_step += 1;
+    wifi_state = WIFI_STATE_SEND;
+}
 
+// The link does not work at the fast rate, blindly ask the ESP to go back to
+// the default rate and verify again.
+static void wifi_baudrate_fallback()
+{
+    if (uart_esp_get_baudrate() == BAUD_RATE && !uart_esp_get_flow_control())
+    {
+        wifi_state = WIFI_STATE_RETRY_DELAY;
+        wifi_timestamp = wifi_now();
+        return;
+    }
+    char command[48];
+    snprintf(command, sizeof(command), "AT+UART_CUR=%u,8,1,0,0\r\n", BAUD_RATE);
+    uart_esp_tx_enqueue((uint8_t *)command, strlen(command));
+    uart_esp_tx_commit();
+    // Switches once the command is out of the UART.
+    wifi_baudrate_switch(BAUD_RATE, false);
 }
 
-// 发送数据函数
-void send_data_to_esp8285(uint8_t *data, int data_size){
+// Messages the ESP prints when the link drops. The receiver only sends frames
+// (and the dongle strips them), so they can not be confused with data. On the
+// dongle a closed connection is just the controller leaving, the server stays.
+static const char *wifi_loss_messages[] = {
+    "WIFI DISCONNECT",
+#if !DONGLE
+    "CLOSED",
+#endif
+};
+#define WIFI_LOSS_MESSAGES_LEN (sizeof(wifi_loss_messages) / sizeof(char*))
 
-    // send_at_command("AT+CIPSEND");
+static uint8_t wifi_loss_matched[WIFI_LOSS_MESSAGES_LEN];
+static const char *wifi_loss = NULL;  // Reason, once the link is lost.
+static bool wifi_stalled = false;
+static uint32_t wifi_stall_start = 0;
+static bool wifi_sync_seen = false;
+static uint32_t wifi_sync_last = 0;
 
-    for (int i = 0; i < data_size; i++) {
-        uart_putc(UART_ID, data[i]);
-        // uart_puts(UART_ID, "\r\n");
+static void wifi_link_reset()
+{
+    memset(wifi_loss_matched, 0, sizeof(wifi_loss_matched));
+    wifi_loss = NULL;
+    wifi_stalled = false;
+    wifi_sync_seen = false;
+}
 
+// Look for the loss messages in the received bytes.
+static void wifi_link_feed(uint8_t byte)
+{
+    for (uint8_t i = 0; i < WIFI_LOSS_MESSAGES_LEN; i++)
+    {
+        const char *message = wifi_loss_messages[i];
+        if (byte == message[wifi_loss_matched[i]])
+            wifi_loss_matched[i] += 1;
+        else
+            wifi_loss_matched[i] = (byte == message[0]) ? 1 : 0;
+        if (message[wifi_loss_matched[i]] == '\0')
+        {
+            wifi_loss_matched[i] = 0;
+            wifi_loss = message;
+        }
     }
+}
 
-    // send_at_command("\x1A");
+#if DONGLE
+// The dongle ESP is not in transparent mode, so it can be queried while
+// receiving (for the RSSI), the answers are picked from between the "+IPD"
+// messages.
+static char wifi_line[64];
+static uint8_t wifi_line_len = 0;
+static bool wifi_query_pending = false;
+static uint32_t wifi_query_time = 0;
 
+static void wifi_query_task(uint32_t now)
+{
+    if (now - wifi_query_time < CFG_WIFI_TELEMETRY_INTERVAL)
+        return;
+    const char *command = "AT+CWJAP_CUR?\r\n";
+    uart_esp_tx_enqueue((uint8_t *)command, strlen(command));
+    uart_esp_tx_commit();
+    wifi_query_pending = true;
+    wifi_query_time = now;
 }
 
-// 从ESP8285接收数据的函数
-uint8_t* receive_data_from_esp8285(int expected_size) {
-    uint8_t* buffer = (uint8_t*)malloc(expected_size);
-    if (buffer == NULL) {
-        printf("内存分配失败，无法创建接收缓冲区\n");
-        return NULL;
+// +CWJAP_CUR:"<ssid>","<bssid>",<channel>,<rssi>
+static void wifi_line_feed(uint8_t byte)
+{
+    if (byte != '\n')
+    {
+        if (wifi_line_len < sizeof(wifi_line) - 1)
+            wifi_line[wifi_line_len++] = byte;
+        return;
     }
+    wifi_line[wifi_line_len] = '\0';
+    wifi_line_len = 0;
+    const char *comma = strrchr(wifi_line, ',');
+    if (!wifi_query_pending || !strstr(wifi_line, "+CWJAP_CUR:") || comma == NULL)
+        return;
+    wifi_stats.rssi = atoi(comma + 1);
+    wifi_stats.at_latency = wifi_now() - wifi_query_time;
+    wifi_query_pending = false;
+}
+#endif
 
-    int received = 0;
-    while (received < expected_size) {
-        if (uart_is_readable(UART_ID)) {
-            buffer[received] = uart_getc(UART_ID);
-            received++;
-        }
+// Use the cached association if there is one, otherwise a regular join.
+static void wifi_format_association()
+{
+    const Config *config = config_read();
+    wifi_fast = config->wifi_header == NVM_CONTROL_BYTE;
+    if (wifi_fast)
+    {
+        const uint8_t *ip = config->wifi_ip;
+        const uint8_t *gateway = config->wifi_gateway;
+        const uint8_t *netmask = config->wifi_netmask;
+        const uint8_t *bssid = config->wifi_bssid;
+        snprintf(
+            uart_command_address,
+            sizeof(uart_command_address),
+            "AT+CIPSTA_CUR=\"%u.%u.%u.%u\",\"%u.%u.%u.%u\",\"%u.%u.%u.%u\"",
+            ip[0], ip[1], ip[2], ip[3],
+            gateway[0], gateway[1], gateway[2], gateway[3],
+            netmask[0], netmask[1], netmask[2], netmask[3]
+        );
+        snprintf(
+            uart_command_join,
+            sizeof(uart_command_join),
+            "AT+CWJAP_CUR=\"%s\",\"%s\",\"%02x:%02x:%02x:%02x:%02x:%02x\"",
+            SSID, password,
+            bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5]
+        );
+    }
+    else
+    {
+        snprintf(uart_command_address, sizeof(uart_command_address), "AT+CWDHCP_CUR=1,1");
+        snprintf(uart_command_join, sizeof(uart_command_join), "AT+CWJAP_CUR=\"%s\",\"%s\"", SSID, password);
     }
+}
 
-    return buffer;
-}
-
-// send struct
-void sendPacketOverWiFi(transfer_struct packet) {
-    // 计算结构体数据总字节数
-    size_t data_size = sizeof(packet.wifi_allow_communication) +
-                       sizeof(packet.synced_keyboard) +
-                       sizeof(packet.synced_mouse) +
-                       sizeof(packet.synced_gamepad) +
-                       sizeof(packet.alarms) +
-                       sizeof(packet.alarm_pool) +
-                       sizeof(packet.wifi_matrix) +
-                       sizeof(packet.mouse_x) +
-                       sizeof(packet.mouse_y) +
-                       sizeof(packet.gamepad_lx) +
-                       sizeof(packet.gamepad_ly) +
-                       sizeof(packet.gamepad_rx) +
-                       sizeof(packet.gamepad_ry) +
-                       sizeof(packet.gamepad_lz) +
-                       sizeof(packet.gamepad_rz) +
-                       sizeof(packet.gamepad_gyro) +
-                       sizeof(packet.gamepad_accel) +
-                       sizeof(packet.switchProUsb);
-
-    // 创建用于存放结构体字节流数据的缓冲区
-    uint8_t * buffer = (uint8_t*)malloc(data_size);
-    if (buffer == NULL) {
-        printf("内存分配失败，无法创建发送缓冲区\n");
+// The cached access point is gone or the address is no longer valid, forget
+// it and associate again from the address step (the one before the join).
+static void wifi_join_failed()
+{
+    if (!wifi_fast)
+    {
+        wifi_state = WIFI_STATE_RETRY_DELAY;
+        wifi_timestamp = wifi_now();
         return;
     }
+    warn("WIFI: Fast reconnect failed, full association\n");
+    config_clear_wifi_cache();
+    wifi_format_association();
+    wifi_step -= 1;
+    wifi_state = WIFI_STATE_SEND;
+}
 
-    // 将结构体成员依次复制到缓冲区，先处理布尔类型成员
-    memcpy(buffer, &packet.wifi_allow_communication, sizeof(packet.wifi_allow_communication));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication), &packet.synced_keyboard, sizeof(packet.synced_keyboard));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard), &packet.synced_mouse, sizeof(packet.synced_mouse));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse), &packet.synced_gamepad, sizeof(packet.synced_gamepad));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad), &packet.alarms, sizeof(packet.alarms));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms), &packet.alarm_pool, sizeof(packet.alarm_pool));
-    // 再处理数组类型成员
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool), packet.wifi_matrix, sizeof(packet.wifi_matrix));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix), &packet.mouse_x, sizeof(packet.mouse_x));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x), &packet.mouse_y, sizeof(packet.mouse_y));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y), &packet.gamepad_lx, sizeof(packet.gamepad_lx));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y) +
-                    sizeof(packet.gamepad_lx), &packet.gamepad_ly, sizeof(packet.gamepad_ly));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y) +
-                    sizeof(packet.gamepad_lx) +
-                    sizeof(packet.gamepad_ly), &packet.gamepad_rx, sizeof(packet.gamepad_rx));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y) +
-                    sizeof(packet.gamepad_lx) +
-                    sizeof(packet.gamepad_ly) +
-                    sizeof(packet.gamepad_rx), &packet.gamepad_ry, sizeof(packet.gamepad_ry));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y) +
-                    sizeof(packet.gamepad_lx) +
-                    sizeof(packet.gamepad_ly) +
-                    sizeof(packet.gamepad_rx) +
-                    sizeof(packet.gamepad_ry), &packet.gamepad_lz, sizeof(packet.gamepad_lz));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y) +
-                    sizeof(packet.gamepad_lx) +
-                    sizeof(packet.gamepad_ly) +
-                    sizeof(packet.gamepad_rx) +
-                    sizeof(packet.gamepad_ry) +
-                    sizeof(packet.gamepad_lz), &packet.gamepad_rz, sizeof(packet.gamepad_rz));
-    // 复制自定义结构体
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y) +
-                    sizeof(packet.gamepad_lx) +
-                    sizeof(packet.gamepad_ly) +
-                    sizeof(packet.gamepad_rx) +
-                    sizeof(packet.gamepad_ry) +
-                    sizeof(packet.gamepad_lz) +
-                    sizeof(packet.gamepad_rz), &packet.gamepad_gyro, sizeof(packet.gamepad_gyro));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y) +
-                    sizeof(packet.gamepad_lx) +
-                    sizeof(packet.gamepad_ly) +
-                    sizeof(packet.gamepad_rx) +
-                    sizeof(packet.gamepad_ry) +
-                    sizeof(packet.gamepad_lz) +
-                    sizeof(packet.gamepad_rz) +
-                    sizeof(packet.gamepad_gyro), &packet.gamepad_accel, sizeof(packet.gamepad_accel));
-    memcpy(buffer + sizeof(packet.wifi_allow_communication) +
-                    sizeof(packet.synced_keyboard) +
-                    sizeof(packet.synced_mouse) +
-                    sizeof(packet.synced_gamepad) +
-                    sizeof(packet.alarms) +
-                    sizeof(packet.alarm_pool) +
-                    sizeof(packet.wifi_matrix) +
-                    sizeof(packet.mouse_x) +
-                    sizeof(packet.mouse_y) +
-                    sizeof(packet.gamepad_lx) +
-                    sizeof(packet.gamepad_ly) +
-                    sizeof(packet.gamepad_rx) +
-                    sizeof(packet.gamepad_ry) +
-                    sizeof(packet.gamepad_lz) +
-                    sizeof(packet.gamepad_rz) +
-                    sizeof(packet.gamepad_gyro) +
-                    sizeof(packet.gamepad_accel), &packet.switchProUsb, sizeof(packet.switchProUsb));
-
-    // 打印缓冲区内容
-    for (int i = 0; i < data_size - 1; i++) {
-        printf("%02X\r\n", buffer[i]);
+// +CWJAP_CUR:"<ssid>","<bssid>",<channel>,<rssi>
+static void wifi_association_read()
+{
+    wifi_bssid_valid = false;
+    const char *line = strstr(buf, "+CWJAP_CUR:");
+    if (line == NULL)
+        return;
+    // The SSID may contain anything, look for the BSSID pattern instead.
+    for (const char *c = line; *c; c++)
+    {
+        if (*c != '"')
+            continue;
+        uint8_t *b = wifi_bssid;
+        int matched = sscanf(
+            c,
+            "\"%2hhx:%2hhx:%2hhx:%2hhx:%2hhx:%2hhx\",%hhu,%hhd",
+            &b[0], &b[1], &b[2], &b[3], &b[4], &b[5], &wifi_channel, &wifi_stats.rssi
+        );
+        if (matched >= 7)
+        {
+            wifi_bssid_valid = true;
+            return;
+        }
     }
-
-    send_data_to_esp8285(buffer, data_size);
-
-    free(buffer);
 }
-/* //send array
-void send_array_over_wifi(uint8_t buffer[256]){
 
-    send_data_to_esp8285(buffer, 256);
+static bool wifi_address_field(const char *field, uint8_t *address)
+{
+    const char *value = strstr(buf, field);
+    if (value == NULL)
+        return false;
+    value += strlen(field);
+    uint8_t *a = address;
+    return sscanf(value, "%hhu.%hhu.%hhu.%hhu", &a[0], &a[1], &a[2], &a[3]) == 4;
+}
 
-} */
+// +CIPSTA_CUR:ip:"<ip>" +CIPSTA_CUR:gateway:"<gateway>" +CIPSTA_CUR:netmask:"<netmask>"
+static void wifi_address_read()
+{
+    uint8_t ip[4];
+    uint8_t gateway[4];
+    uint8_t netmask[4];
+    if (
+        !wifi_bssid_valid ||
+        !wifi_address_field("+CIPSTA_CUR:ip:\"", ip) ||
+        !wifi_address_field("+CIPSTA_CUR:gateway:\"", gateway) ||
+        !wifi_address_field("+CIPSTA_CUR:netmask:\"", netmask))
+    {
+        warn("WIFI: Could not read the association\n");
+        return;
+    }
+    info(
+        "WIFI: Access point %02x:%02x:%02x:%02x:%02x:%02x channel %u\n",
+        wifi_bssid[0], wifi_bssid[1], wifi_bssid[2],
+        wifi_bssid[3], wifi_bssid[4], wifi_bssid[5],
+        wifi_channel
+    );
+    config_set_wifi_cache(wifi_bssid, wifi_channel, ip, gateway, netmask);
+}
 
+// Start the association in the background, see wifi_sta_task().
+void connectToWifi() {
+    snprintf(
+        uart_command_baudrate,
+        sizeof(uart_command_baudrate),
+        "AT+UART_CUR=%u,8,1,0,%u",
+        CFG_WIFI_UART_BAUDRATE,
+        CFG_WIFI_UART_FLOW_CONTROL ? 3 : 0
+    );
+    wifi_format_association();
+#if DONGLE
+#if CFG_WIFI_TRANSPORT == WIFI_TRANSPORT_UDP
+    // Accept datagrams from any remote (mode 2) on the local port.
+    snprintf(uart_command_start, sizeof(uart_command_start), "AT+CIPSTART=\"UDP\",\"0.0.0.0\",0,%s,2", Port);
+#else
+    snprintf(uart_command_start, sizeof(uart_command_start), "AT+CIPSERVER=1,%s", Port);
+#endif
+#elif CFG_WIFI_TRANSPORT == WIFI_TRANSPORT_UDP
+    // Fixed remote (mode 0) is required for transparent UDP.
+    snprintf(uart_command_start, sizeof(uart_command_start), "AT+CIPSTART=\"UDP\",\"%s\",%s,%s,0", ServerIP, Port, Port);
+#else
+    snprintf(uart_command_start, sizeof(uart_command_start), "AT+CIPSTART=\"TCP\",\"%s\",%s", ServerIP, Port);
+#endif
+    wifi_step = 0;
+    wifi_attempt = 0;
+    wifi_connect_start = wifi_now();
+    wifi_state = WIFI_STATE_SEND;
+    info("WIFI: Connecting to %s%s\n", SSID, wifi_fast ? " (fast reconnect)" : "");
+}
 
+bool wifi_is_connected()
+{
+    return wifi_state == WIFI_STATE_CONNECTED;
+}
 
-// 接收并解包数据到结构体
-transfer_struct receivePacketOverWiFi() {
-    transfer_struct received_packet;
-    
-    // 计算需要接收的总字节数
-    size_t data_size = sizeof(received_packet.wifi_allow_communication) + 
-                       sizeof(received_packet.synced_keyboard) + 
-                       sizeof(received_packet.synced_mouse) + 
-                       sizeof(received_packet.synced_gamepad) + 
-                       sizeof(received_packet.alarms) + 
-                       sizeof(received_packet.alarm_pool) +
-                       sizeof(received_packet.wifi_matrix) + 
-                       sizeof(received_packet.mouse_x) + 
-                       sizeof(received_packet.mouse_y) + 
-                       sizeof(received_packet.gamepad_lx) + 
-                       sizeof(received_packet.gamepad_ly) + 
-                       sizeof(received_packet.gamepad_rx) + 
-                       sizeof(received_packet.gamepad_ry) + 
-                       sizeof(received_packet.gamepad_lz) + 
-                       sizeof(received_packet.gamepad_rz) +
-                       sizeof(received_packet.gamepad_gyro) + 
-                       sizeof(received_packet.gamepad_accel) +
-                       sizeof(received_packet.switchProUsb);
+#if !DONGLE
+// Answer the clock sync requests of the receiver (see FrameSync), the only data
+// the receiver sends to the controller.
+static void wifi_sync_task()
+{
+    static FrameParser sync_parser;
+    static bool sync_parser_initialized = false;
+    static Frame request;
+    static Frame answer;
+    if (!sync_parser_initialized)
+    {
+        frame_parser_init(&sync_parser);
+        sync_parser_initialized = true;
+    }
+    uint8_t data[32];
+    uint16_t len;
+    while ((len = uart_esp_rx_read(data, sizeof(data))) > 0)
+    {
+        for (uint16_t i = 0; i < len; i++)
+        {
+            wifi_link_feed(data[i]);
+            if (!frame_parser_feed(&sync_parser, data[i], &request))
+                continue;
+            if (!(request.header.flags & FRAME_FLAG_SYNC))
+                continue;
+            wifi_sync_seen = true;
+            wifi_sync_last = wifi_now();
+            memset(&answer, 0, sizeof(Frame));
+            answer.header.flags = FRAME_FLAG_SYNC;
+            answer.sync.request = request.sync.request;
+            answer.sync.received = uart_esp_rx_timestamp();
+            answer.sync.sent = time_us_32();
+            answer.header.time = answer.sync.sent;
+            sendPacketOverWiFi(&answer);
+        }
+    }
+}
+#endif
 
-    // 接收数据
-    uint8_t* buffer = receive_data_from_esp8285(data_size);
-    if (buffer == NULL) {
-        // 返回一个空的结构体或错误标志
-        memset(&received_packet, 0, sizeof(transfer_struct));
-        return received_packet;
+// Detect a lost link and associate again, in the background like the first
+// time (the main loop keeps running, and the reports are held meanwhile).
+static void wifi_link_task()
+{
+    uint32_t now = wifi_now();
+    const char *reason = wifi_loss;
+    if (uart_esp_tx_pending() > CFG_WIFI_BACKLOG_LIMIT)
+    {
+        if (!wifi_stalled)
+        {
+            wifi_stalled = true;
+            wifi_stall_start = now;
+        }
+        else if (now - wifi_stall_start >= CFG_WIFI_STALL_TIMEOUT)
+        {
+            reason = "TX stalled";
+        }
     }
+    else
+    {
+        wifi_stalled = false;
+    }
+    if (wifi_sync_seen && now - wifi_sync_last >= CFG_WIFI_SYNC_TIMEOUT)
+        reason = "no sync requests";
+    if (reason == NULL)
+        return;
+    warn("WIFI: Link lost (%s)\n", reason);
+    wifi_stats.reconnects += 1;
+    connectToWifi();
+}
 
-    size_t offset = 0;
+// Refresh the link health once per second.
+static void wifi_stats_task()
+{
+    static uint32_t last = 0;
+    static uint32_t tx_bytes = 0;
+    uint32_t now = wifi_now();
+    if (now - last < 1000)
+        return;
+    last = now;
+    UartTxStats tx = uart_esp_tx_stats();
+    wifi_stats.tx_bytes = tx.bytes - tx_bytes;
+    tx_bytes = tx.bytes;
+    wifi_stats.frames = wifi_frames;
+    wifi_frames = 0;
+    wifi_stats.queue = uart_esp_tx_pending();
+    wifi_stats.queue_max = tx.high_water;
+    wifi_stats.dropped = tx.overflows;
+}
 
-    // 按照发送时相同的顺序解包数据
-    memcpy(&received_packet.wifi_allow_communication, buffer + offset, sizeof(received_packet.wifi_allow_communication));
-    offset += sizeof(received_packet.wifi_allow_communication);
+WifiStats wifi_get_stats()
+{
+    return wifi_stats;
+}
 
-    memcpy(&received_packet.synced_keyboard, buffer + offset, sizeof(received_packet.synced_keyboard));
-    offset += sizeof(received_packet.synced_keyboard);
+void wifi_stats_print()
+{
+    const WifiStats *stats = &wifi_stats;
+    info(
+        "WIFI: %s rssi=%i dBm at_latency=%u ms reconnects=%u\n",
+        wifi_is_connected() ? "connected" : "not connected",
+        stats->rssi,
+        stats->at_latency,
+        stats->reconnects
+    );
+    info(
+        "WIFI: tx=%lu B/s frames=%u/s queue=%u max=%u dropped=%lu\n",
+        (unsigned long)stats->tx_bytes,
+        stats->frames,
+        stats->queue,
+        stats->queue_max,
+        (unsigned long)stats->dropped
+    );
+}
 
-    memcpy(&received_packet.synced_mouse, buffer + offset, sizeof(received_packet.synced_mouse));
-    offset += sizeof(received_packet.synced_mouse);
+void wifi_sta_task()
+{
+    wifi_stats_task();
+    if (wifi_state == WIFI_STATE_CONNECTED)
+    {
+#if !DONGLE
+        wifi_sync_task();
+#else
+        wifi_query_task(wifi_now());
+#endif
+        wifi_link_task();
+    }
+    if (wifi_state == WIFI_STATE_IDLE || wifi_state == WIFI_STATE_CONNECTED)
+        return;
+    if (wifi_state == WIFI_STATE_RETRY_DELAY)
+    {
+        if (wifi_now() - wifi_timestamp < CFG_WIFI_RETRY_DELAY)
+            return;
+        wifi_step = 0;
+        wifi_attempt = 0;
+        wifi_state = WIFI_STATE_SEND;
+        if (wifi_probe_next)
+        {
+            // The ESP may be at any of the known rates.
+            wifi_probe_next = false;
+            wifi_probe = (wifi_probe + 1) % (sizeof(baudrates) / sizeof(uint32_t));
+            wifi_baudrate_switch(baudrates[wifi_probe], false);
+        }
+    }
+    if (wifi_state == WIFI_STATE_BAUDRATE)
+    {
+        if (!uart_esp_tx_idle())
+            return;
+        uart_esp_set_baudrate(wifi_baudrate, wifi_flow_control);
+        wifi_state = WIFI_STATE_SEND;
+    }
+    const AtStep *step = &steps[wifi_step];
+    if (wifi_state == WIFI_STATE_SEND)
+    {
+        if (step->command)
+        {
+            uart_esp_tx_enqueue((uint8_t *)step->command, strlen(step->command));
+            if (!step->raw)
+                uart_esp_tx_enqueue((uint8_t *)"\r\n", 2);
+            uart_esp_tx_commit();
+        }
+        wifi_received = 0;
+        wifi_timestamp = wifi_now();
+        wifi_state = WIFI_STATE_WAIT;
+        return;
+    }
+    // Collect the response.
+    uint16_t received = uart_esp_rx_read(
+        (uint8_t *)buf + wifi_received,
+        sizeof(buf) - 1 - wifi_received
+    );
+    wifi_received += received;
+    buf[wifi_received] = '\0';
+    if (step->response && strstr(buf, step->response) != NULL)
+    {
+        wifi_step_completed();
+        return;
+    }
+    if (step->response && (strstr(buf, "ERROR") != NULL || strstr(buf, "FAIL") != NULL))
+    {
+        wifi_step_failed("error");
+        return;
+    }
+    if (wifi_received == sizeof(buf) - 1)
+    {
+        // Keep the tail, the response may be split.
+        memmove(buf, buf + sizeof(buf) / 2, sizeof(buf) / 2);
+        wifi_received -= sizeof(buf) / 2;
+    }
+    if (wifi_now() - wifi_timestamp >= step->timeout)
+    {
+        if (step->response)
+            wifi_step_failed("timeout");
+        else
+            wifi_step_completed();
+    }
+}
 
-    memcpy(&received_packet.synced_gamepad, buffer + offset, sizeof(received_packet.synced_gamepad));
-    offset += sizeof(received_packet.synced_gamepad);
+// 发送数据函数，数据进入 DMA 发送环形缓冲区，不阻塞主循环
+void send_data_to_esp8285(uint8_t *data, int data_size){
+    uart_esp_tx_enqueue(data, data_size);
+    uart_esp_tx_commit();
+}
 
-    memcpy(&received_packet.alarms, buffer + offset, sizeof(received_packet.alarms));
-    offset += sizeof(received_packet.alarms);
+// Resolve an axis the same way the HID layer does, so axis actions (eg: a
+// button mapped to GAMEPAD_AXIS_LX) are already applied in the frame.
+static double wifi_axis(
+    const transfer_struct *packet,
+    double value,
+    uint8_t matrix_index_pos,
+    uint8_t matrix_index_neg)
+{
+    if (matrix_index_neg)
+    {
+        if (packet->wifi_matrix[matrix_index_neg])
+            return -1;
+        else if (packet->wifi_matrix[matrix_index_pos])
+            return 1;
+        else
+            return constrain(value, -1, 1);
+    }
+    else
+    {
+        if (packet->wifi_matrix[matrix_index_pos])
+            return 1;
+        else
+            return constrain(fabs(value), 0, 1);
+    }
+}
 
-    memcpy(&received_packet.alarm_pool, buffer + offset, sizeof(received_packet.alarm_pool));
-    offset += sizeof(received_packet.alarm_pool);
+// Build a frame with every section filled, the caller chooses which sections
+// are sent by setting the header flags.
+void wifi_frame_from_transfer(const transfer_struct *packet, Frame *frame)
+{
+    memset(frame, 0, sizeof(Frame));
+    // Digital actions, axis actions and scroll go in their own sections.
+    for (uint16_t i = 1; i < FRAME_ACTIONS_LEN; i++)
+    {
+        if (packet->wifi_matrix[i] && wifi_section(i) == FRAME_FLAG_DIGITAL)
+            frame_action_set(&frame->digital, i, true);
+    }
+    // Axes.
+    FrameAxes *axes = &frame->axes;
+    axes->axes[FRAME_AXIS_LX] = frame_quantize(wifi_axis(packet, packet->gamepad_lx, GAMEPAD_AXIS_LX, GAMEPAD_AXIS_LX_NEG), FRAME_AXIS_SCALE);
+    axes->axes[FRAME_AXIS_LY] = frame_quantize(wifi_axis(packet, packet->gamepad_ly, GAMEPAD_AXIS_LY, GAMEPAD_AXIS_LY_NEG), FRAME_AXIS_SCALE);
+    axes->axes[FRAME_AXIS_RX] = frame_quantize(wifi_axis(packet, packet->gamepad_rx, GAMEPAD_AXIS_RX, GAMEPAD_AXIS_RX_NEG), FRAME_AXIS_SCALE);
+    axes->axes[FRAME_AXIS_RY] = frame_quantize(wifi_axis(packet, packet->gamepad_ry, GAMEPAD_AXIS_RY, GAMEPAD_AXIS_RY_NEG), FRAME_AXIS_SCALE);
+    axes->axes[FRAME_AXIS_LZ] = frame_quantize(wifi_axis(packet, packet->gamepad_lz, GAMEPAD_AXIS_LZ, 0), FRAME_AXIS_SCALE);
+    axes->axes[FRAME_AXIS_RZ] = frame_quantize(wifi_axis(packet, packet->gamepad_rz, GAMEPAD_AXIS_RZ, 0), FRAME_AXIS_SCALE);
+    // Mouse movement.
+    frame->mouse.x = packet->mouse_x;
+    frame->mouse.y = packet->mouse_y;
+    frame->mouse.scroll = packet->wifi_matrix[MOUSE_SCROLL_UP] - packet->wifi_matrix[MOUSE_SCROLL_DOWN];
+    // Motion, already in IMU units.
+    const Vector *gyro = &packet->gamepad_gyro;
+    frame->gyro.x = frame_quantize(gyro->x, 1);
+    frame->gyro.y = frame_quantize(gyro->y, 1);
+    frame->gyro.z = frame_quantize(gyro->z, 1);
+    const Vector *accel = &packet->gamepad_accel;
+    frame->accel.x = frame_quantize(accel->x, 1);
+    frame->accel.y = frame_quantize(accel->y, 1);
+    frame->accel.z = frame_quantize(accel->z, 1);
+    // Last digital transitions.
+    frame->history = packet->history;
+}
 
-    memcpy(received_packet.wifi_matrix, buffer + offset, sizeof(received_packet.wifi_matrix));
-    offset += sizeof(received_packet.wifi_matrix);
+static void wifi_frame_to_transfer(const Frame *frame, transfer_struct *packet)
+{
+    memset(packet, 0, sizeof(transfer_struct));
+    packet->wifi_allow_communication = true;
+    // Digital actions.
+    for (uint16_t i = 1; i < FRAME_ACTIONS_LEN; i++)
+    {
+        if (frame_action_get(&frame->digital, i))
+            packet->wifi_matrix[i] = 1;
+    }
+    // Axes.
+    const FrameAxes *axes = &frame->axes;
+    packet->gamepad_lx = axes->axes[FRAME_AXIS_LX] / (double)FRAME_AXIS_SCALE;
+    packet->gamepad_ly = axes->axes[FRAME_AXIS_LY] / (double)FRAME_AXIS_SCALE;
+    packet->gamepad_rx = axes->axes[FRAME_AXIS_RX] / (double)FRAME_AXIS_SCALE;
+    packet->gamepad_ry = axes->axes[FRAME_AXIS_RY] / (double)FRAME_AXIS_SCALE;
+    packet->gamepad_lz = axes->axes[FRAME_AXIS_LZ] / (double)FRAME_AXIS_SCALE;
+    packet->gamepad_rz = axes->axes[FRAME_AXIS_RZ] / (double)FRAME_AXIS_SCALE;
+    // Mouse.
+    packet->mouse_x = frame->mouse.x;
+    packet->mouse_y = frame->mouse.y;
+    if (frame->mouse.scroll > 0)
+        packet->wifi_matrix[MOUSE_SCROLL_UP] = frame->mouse.scroll;
+    if (frame->mouse.scroll < 0)
+        packet->wifi_matrix[MOUSE_SCROLL_DOWN] = -frame->mouse.scroll;
+    // Motion.
+    packet->gamepad_gyro = (Vector){frame->gyro.x, frame->gyro.y, frame->gyro.z};
+    packet->gamepad_accel = (Vector){frame->accel.x, frame->accel.y, frame->accel.z};
+}
 
-    memcpy(&received_packet.mouse_x, buffer + offset, sizeof(received_packet.mouse_x));
-    offset += sizeof(received_packet.mouse_x);
+// send frame
+// The frame is serialized in place into a static buffer, so the send path
+// never allocates nor copies the frame on the stack.
+void sendPacketOverWiFi(const Frame *frame) {
+    static uint16_t sequence = 0;
+    static uint8_t buffer[FRAME_PACKED_MAX_SIZE];
+    uint8_t data_size = frame_pack(buffer, sequence, frame);
+    send_data_to_esp8285(buffer, data_size);
+    trace_frame(TRACE_TX, sequence, frame->header.flags, data_size);
+    sequence += 1;
+    wifi_frames += 1;
+}
+/* //send array
+void send_array_over_wifi(uint8_t buffer[256]){
 
-    memcpy(&received_packet.mouse_y, buffer + offset, sizeof(received_packet.mouse_y));
-    offset += sizeof(received_packet.mouse_y);
+    send_data_to_esp8285(buffer, 256);
 
-    memcpy(&received_packet.gamepad_lx, buffer + offset, sizeof(received_packet.gamepad_lx));
-    offset += sizeof(received_packet.gamepad_lx);
+} */
 
-    memcpy(&received_packet.gamepad_ly, buffer + offset, sizeof(received_packet.gamepad_ly));
-    offset += sizeof(received_packet.gamepad_ly);
 
-    memcpy(&received_packet.gamepad_rx, buffer + offset, sizeof(received_packet.gamepad_rx));
-    offset += sizeof(received_packet.gamepad_rx);
 
-    memcpy(&received_packet.gamepad_ry, buffer + offset, sizeof(received_packet.gamepad_ry));
-    offset += sizeof(received_packet.gamepad_ry);
+// Frames only carry the sections that changed, the rest is kept here.
+static Frame received_state = {0};
+static FrameParser parser;
+static bool parser_initialized = false;
+// Continuous sections are played evenly from here, see playout.c.
+static Playout playout;
 
-    memcpy(&received_packet.gamepad_lz, buffer + offset, sizeof(received_packet.gamepad_lz));
-    offset += sizeof(received_packet.gamepad_lz);
+// Double buffer for the unpacked state, one is written while the other (the
+// last one returned) is still valid for the caller.
+static transfer_struct received_packets[2];
+static uint8_t received_index = 0;
 
-    memcpy(&received_packet.gamepad_rz, buffer + offset, sizeof(received_packet.gamepad_rz));
-    offset += sizeof(received_packet.gamepad_rz);
+// Presses recovered from the transitions history, forced even if the state
+// already shows them released, so quick taps survive lost frames. They stay
+// forced until the HID reports were queued with them (see hid_synced).
+static uint8_t taps[FRAME_HISTORY_LEN];
+static uint8_t taps_len = 0;
+static uint8_t taps_forced = 0;    // Forced in the last state returned.
+static bool taps_release = false;  // Taps were reported, report the release.
+static uint32_t received_time = 0;  // Microseconds, last frame completed.
+static bool history_has_sequence = false;
+static uint8_t history_sequence = 0;
 
-    memcpy(&received_packet.gamepad_gyro, buffer + offset, sizeof(received_packet.gamepad_gyro));
-    offset += sizeof(received_packet.gamepad_gyro);
+#if DONGLE
+// Without transparent mode (the dongle ESP is listening) the data arrives
+// wrapped as "+IPD,<length>:<data>", or "+IPD,<link>,<length>:<data>" on TCP.
+// The wrapper is removed before the frame parser, anything between messages
+// (eg: "0,CONNECT") is ignored.
+typedef enum _IpdState
+{
+    IPD_SCAN,
+    IPD_HEADER,
+    IPD_PAYLOAD,
+} IpdState;
 
-    memcpy(&received_packet.gamepad_accel, buffer + offset, sizeof(received_packet.gamepad_accel));
-    offset += sizeof(received_packet.gamepad_accel);
+#define IPD_PREFIX "+IPD,"
+#define IPD_PREFIX_LEN 5
+#define IPD_MAX_LENGTH 2048
 
-    memcpy(&received_packet.switchProUsb, buffer + offset, sizeof(received_packet.switchProUsb));
+static IpdState ipd_state = IPD_SCAN;
+static uint8_t ipd_matched = 0;
+static uint16_t ipd_length = 0;
 
-    // 打印接收到的数据（用于调试）
-    for (int i = 0; i < data_size; i++) {
-        printf("Received: %02X\r\n", buffer[i]);
+// Filter the data in place, returns the length of the payload left.
+static uint16_t wifi_ipd_payload(uint8_t *data, uint16_t len) {
+    uint16_t payload = 0;
+    for (uint16_t i = 0; i < len; i++) {
+        uint8_t byte = data[i];
+        if (ipd_state == IPD_PAYLOAD) {
+            data[payload++] = byte;
+            ipd_length -= 1;
+            if (ipd_length == 0) {
+                ipd_state = IPD_SCAN;
+            }
+        }
+        else if (ipd_state == IPD_HEADER) {
+            if (byte == ':') {
+                ipd_state = ipd_length ? IPD_PAYLOAD : IPD_SCAN;
+            }
+            else if (byte == ',') {
+                ipd_length = 0;  // It was the link, the length follows.
+            }
+            else if (byte >= '0' && byte <= '9' && ipd_length < IPD_MAX_LENGTH) {
+                ipd_length = (ipd_length * 10) + (byte - '0');
+            }
+            else {
+                ipd_state = IPD_SCAN;
+            }
+        }
+        else {
+            wifi_link_feed(byte);
+            wifi_line_feed(byte);
+            if (byte == IPD_PREFIX[ipd_matched]) {
+                ipd_matched += 1;
+            }
+            else {
+                ipd_matched = (byte == IPD_PREFIX[0]) ? 1 : 0;
+            }
+            if (ipd_matched == IPD_PREFIX_LEN) {
+                ipd_state = IPD_HEADER;
+                ipd_matched = 0;
+                ipd_length = 0;
+            }
+        }
     }
+    return payload;
+}
+#endif
 
-    free(buffer);
+static void wifi_history_recover(const Frame *frame) {
+    FrameTransition transitions[FRAME_HISTORY_LEN];
+    uint8_t len = frame_history_new(
+        &frame->history,
+        &history_has_sequence,
+        &history_sequence,
+        transitions
+    );
+    for (uint8_t i = 0; i < len; i++) {
+        if (!transitions[i].pressed || taps_len >= FRAME_HISTORY_LEN) {
+            continue;
+        }
+        taps[taps_len++] = transitions[i].action;
+    }
+}
+
+// 接收并解包数据到结构体. Never blocks, parses whatever the UART RX IRQ has
+// collected so far. Must be called every tick, since the continuous sections
+// are played over time. Returns the state if it changed (any frame was received
+// or the playout moved), NULL otherwise. The pointer is valid until the next
+// call that returns a state.
+const transfer_struct* receivePacketOverWiFi() {
+    if (!parser_initialized) {
+        frame_parser_init(&parser);
+        playout_init(&playout);
+        parser_initialized = true;
+    }
+    if (taps_forced && hid_synced()) {
+        taps_len -= taps_forced;
+        memmove(taps, taps + taps_forced, taps_len);
+        taps_forced = 0;
+    }
+    bool received = false;
+    static uint8_t data[64];
+    uint16_t data_size;
+    while ((data_size = uart_esp_rx_read(data, sizeof(data))) > 0) {
+#if DONGLE
+        data_size = wifi_ipd_payload(data, data_size);
+#endif
+        for (int i = 0; i < data_size; i++) {
+            Frame frame;
+            if (frame_parser_feed(&parser, data[i], &frame)) {
+                received_time = time_us_32();
+                FrameMouse mouse = received_state.mouse;
+                frame_merge(&received_state, &frame);
+                // Several frames in one call add up their mouse movement.
+                received_state.mouse.x += mouse.x;
+                received_state.mouse.y += mouse.y;
+                received_state.mouse.scroll += mouse.scroll;
+                if (frame.header.flags & FRAME_FLAG_HISTORY) {
+                    wifi_history_recover(&frame);
+                }
+                // Every sample of the motion batch is played at its own time
+                // (see playout.c), the state keeps the newest one.
+                const FrameMotion *motion = NULL;
+                if ((frame.header.flags & FRAME_FLAG_MOTION) && frame.motion.len) {
+                    motion = &frame.motion;
+                    const FrameMotionSample *sample = &frame.motion.samples[frame.motion.len - 1];
+                    received_state.gyro = sample->gyro;
+                    received_state.accel = sample->accel;
+                }
+                playout_push(&playout, &received_state, motion, received_time);
+                received = true;
+                trace_frame(
+                    TRACE_RX,
+                    parser.sequence,
+                    frame.header.flags,
+                    frame_size(&frame) + FRAME_ENVELOPE_SIZE
+                );
+            }
+        }
+    }
+    static Frame output;
+    output = received_state;
+    bool played = playout_sample(&playout, time_us_32(), &output);
+    if (!received && !taps_len && !taps_release && !played) {
+        return NULL;
+    }
+    received_index ^= 1;
+    transfer_struct *received_packet = &received_packets[received_index];
+    wifi_frame_to_transfer(&output, received_packet);
+    // Mouse movement is consumed once reported.
+    memset(&received_state.mouse, 0, sizeof(FrameMouse));
+    taps_release = taps_len > 0;
+    for (uint8_t i = 0; i < taps_len; i++) {
+        received_packet->wifi_matrix[taps[i]] = 1;
+    }
+    taps_forced = taps_len;
     return received_packet;
 }
 
+FrameParserStats receivePacketStats() {
+    return parser.stats;
+}
+
+PlayoutStats receivePlayoutStats() {
+    return playout.stats;
+}
+
+// Time when the last frame was completed, in microseconds. Unlike the UART
+// receive time it does not move with the AT messages between frames.
+uint32_t receivePacketTime() {
+    return received_time;
+}
+
+// Current playout delay (over the fastest transit seen), in microseconds.
+uint32_t receivePlayoutDelay() {
+    return playout.delay;
+}
+
 // 处理接收到的数据包
-void process_received_packet(transfer_struct received_packet) {
+void process_received_packet(const transfer_struct *received_packet) {
     // 通信状态标志
-    hid_allow_communication = received_packet.wifi_allow_communication;
-    
-    // 同步状态
-    synced_keyboard = received_packet.synced_keyboard;
-    synced_mouse = received_packet.synced_mouse;
-    synced_gamepad = received_packet.synced_gamepad;
+    hid_allow_communication = received_packet->wifi_allow_communication;
     
-    // 警报相关
-    alarms = received_packet.alarms;
-    alarm_pool = received_packet.alarm_pool;
+    // A new frame always carries new state to be reported.
+    synced_keyboard = false;
+    synced_mouse = false;
+    synced_gamepad = false;
     
     // 复制WiFi矩阵
-    memcpy(state_matrix, received_packet.wifi_matrix, sizeof(state_matrix));
+    memcpy(state_matrix, received_packet->wifi_matrix, sizeof(state_matrix));
+    hid_matrix_sync();
     
     // 鼠标数据
-    mouse_x = received_packet.mouse_x;
-    mouse_y = received_packet.mouse_y;
+    // Movement adds up until the next mouse report, like hid_mouse_move().
+    mouse_x += received_packet->mouse_x;
+    mouse_y += received_packet->mouse_y;
     
     // 游戏手柄数据
-    gamepad_lx = received_packet.gamepad_lx;
-    gamepad_ly = received_packet.gamepad_ly;
-    gamepad_rx = received_packet.gamepad_rx;
-    gamepad_ry = received_packet.gamepad_ry;
-    gamepad_lz = received_packet.gamepad_lz;
-    gamepad_rz = received_packet.gamepad_rz;
+    gamepad_lx = received_packet->gamepad_lx;
+    gamepad_ly = received_packet->gamepad_ly;
+    gamepad_rx = received_packet->gamepad_rx;
+    gamepad_ry = received_packet->gamepad_ry;
+    gamepad_lz = received_packet->gamepad_lz;
+    gamepad_rz = received_packet->gamepad_rz;
     
     // 陀螺仪和加速度计数据
-    gamepad_gyro = received_packet.gamepad_gyro;
-    gamepad_accel = received_packet.gamepad_accel;
-    
-    // Switch Pro控制器USB状态
-    switchProUsb = received_packet.switchProUsb;
-    
-    // 打印接收到的数据（用于调试）
-    printf("WiFi通信状态: %d\n", wifi_comm_allowed);
-    printf("键盘同步状态: %d\n", keyboard_synced);
-    printf("鼠标同步状态: %d\n", mouse_synced);
-    printf("手柄同步状态: %d\n", gamepad_synced);
-    printf("当前警报: %d\n", current_alarms);
-    printf("警报池状态: %d\n", alarm_pool_status);
-    
-    // 打印WiFi矩阵（如果需要）
-    printf("WiFi矩阵内容:\n");
-    for (int i = 0; i < MATRIX_ROWS; i++) {
-        for (int j = 0; j < MATRIX_COLS; j++) {
-            printf("%02X ", wifi_matrix_copy[i][j]);
-        }
-        printf("\n");
-    }
-    
-    printf("鼠标位置: X=%d, Y=%d\n", mouse_pos_x, mouse_pos_y);
-    printf("游戏手柄左摇杆: X=%d, Y=%d\n", gamepad_left_x, gamepad_left_y);
-    printf("游戏手柄右摇杆: X=%d, Y=%d\n", gamepad_right_x, gamepad_right_y);
-    printf("游戏手柄扳机键: L=%d, R=%d\n", gamepad_left_z, gamepad_right_z);
-    printf("陀螺仪数据: %d\n", gamepad_gyro_data);
-    printf("加速度计数据: %d\n", gamepad_accel_data);
-    printf("Switch Pro USB状态: %d\n", switch_pro_usb_status);
+    gamepad_gyro = received_packet->gamepad_gyro;
+    gamepad_accel = received_packet->gamepad_accel;
 }
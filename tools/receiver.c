@@ -0,0 +1,599 @@
+// SPDX-License-Identifier: GPL-2.0-only
+// Copyright (C) 2022, Input Labs Oy.
+
+/*
+Host-side receiver for the controller wireless stream, a stand-in for the PC
+side so the wireless path can be benchmarked on a plain Linux machine.
+
+It listens on TCP or UDP (see CFG_WIFI_TRANSPORT in the firmware), decodes the
+frames with the same frame.c as the firmware, and prints once per second the
+frame rate, arrival interval, jitter, and the loss counters of the parser.
+
+Optionally every frame can be printed (-v), the decoded state appended to a CSV
+capture file (-c) and forwarded to a virtual gamepad through uinput (-g).
+
+Every second it also sends a clock sync request to the controller, once the
+controller clock is known the capture time of each frame gives the one-way
+latency, which is collected per input type and printed as histograms on exit.
+
+Build with "make receiver", the binary is placed in build/.
+
+Usage: receiver [-u] [-p port] [-v] [-c capture.csv] [-g]
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/uinput.h>
+#include "frame.h"
+
+#define DEFAULT_PORT 8080
+#define JITTER_SMOOTH 16 // Same smoothing as RFC 3550.
+// The firmware sends a heartbeat while idle (CFG_WIFI_HEARTBEAT_INTERVAL), so
+// several missing in a row means the link is lost.
+#define LINK_LOST_TIMEOUT 500 // Milliseconds.
+#define SYNC_INTERVAL 1000000 // Microseconds between clock sync requests.
+#define LATENCY_BIN 250 // Microseconds.
+#define LATENCY_BINS 200 // Up to 50 ms, the last bin collects the rest.
+#define GAMEPAD_INDEX 174 // First gamepad button action, same as hid.h.
+
+typedef struct
+{
+    bool udp;
+    bool verbose;
+    bool gamepad;
+    uint16_t port;
+    const char *capture;
+} Options;
+
+typedef struct
+{
+    uint64_t last_arrival; // Microseconds.
+    bool link_lost;
+    uint32_t recovered;    // Taps (press and release) recovered from the history.
+    double last_interval;  // Milliseconds.
+    double jitter;         // Milliseconds.
+    // Reset every report.
+    uint32_t frames;
+    uint32_t heartbeats;  // Frames without any section (TCP idle).
+    uint32_t samples;     // IMU samples in the motion batches.
+    uint32_t bytes;
+    double interval_sum;
+    double interval_min;
+    double interval_max;
+    uint32_t intervals;
+} Stats;
+
+typedef struct
+{
+    const char *name;
+    uint8_t flag;
+    uint32_t count;
+    uint32_t bins[LATENCY_BINS];
+} Latency;
+
+static volatile bool running = true;
+static FrameParser parser;
+static Frame state = {0};
+static Stats stats = {0};
+static bool history_has_sequence = false;
+static uint8_t history_sequence = 0;
+static FrameClock clock_sync = {0};
+static uint16_t sync_sequence = 0;
+static Latency latencies[] = {
+    {.name = "digital", .flag = FRAME_FLAG_DIGITAL},
+    {.name = "axes", .flag = FRAME_FLAG_AXES},
+    {.name = "mouse", .flag = FRAME_FLAG_MOUSE},
+    {.name = "gyro", .flag = FRAME_FLAG_GYRO},
+    {.name = "accel", .flag = FRAME_FLAG_ACCEL},
+    {.name = "motion", .flag = FRAME_FLAG_MOTION}, // Per sample, from its capture.
+};
+
+#define LATENCIES_LEN (sizeof(latencies) / sizeof(Latency))
+static FILE *capture = NULL;
+static int uinput = -1;
+
+// Gamepad button actions (GAMEPAD_INDEX + N) to evdev buttons.
+static const int gamepad_buttons[16] = {
+    BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT,
+    BTN_START, BTN_SELECT, BTN_THUMBL, BTN_THUMBR,
+    BTN_TL, BTN_TR, BTN_MODE, 0,
+    BTN_SOUTH, BTN_EAST, BTN_WEST, BTN_NORTH,
+};
+
+// Frame axes order to evdev axes.
+static const int gamepad_axes[FRAME_AXIS_LEN] = {
+    ABS_X, ABS_Y, ABS_RX, ABS_RY, ABS_Z, ABS_RZ,
+};
+
+static uint64_t now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    running = false;
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: receiver [-u] [-p port] [-v] [-c capture.csv] [-g]\n");
+    fprintf(stderr, "  -u  Listen on UDP instead of TCP\n");
+    fprintf(stderr, "  -p  Port (default %i)\n", DEFAULT_PORT);
+    fprintf(stderr, "  -v  Print every frame\n");
+    fprintf(stderr, "  -c  Append decoded state to a CSV file\n");
+    fprintf(stderr, "  -g  Forward state to a virtual gamepad (uinput)\n");
+    exit(1);
+}
+
+static Options parse_options(int argc, char **argv)
+{
+    Options options = {.port = DEFAULT_PORT};
+    int opt;
+    while ((opt = getopt(argc, argv, "up:vc:g")) != -1)
+    {
+        if (opt == 'u')
+            options.udp = true;
+        else if (opt == 'p')
+            options.port = atoi(optarg);
+        else if (opt == 'v')
+            options.verbose = true;
+        else if (opt == 'c')
+            options.capture = optarg;
+        else if (opt == 'g')
+            options.gamepad = true;
+        else
+            usage();
+    }
+    return options;
+}
+
+// ============================================================================
+// Outputs.
+
+static void capture_open(const char *path)
+{
+    capture = fopen(path, "a");
+    if (capture == NULL)
+    {
+        perror("capture");
+        exit(1);
+    }
+    fprintf(capture,
+        "time_us,sequence,flags,actions,"
+        "lx,ly,rx,ry,lz,rz,mouse_x,mouse_y,scroll,"
+        "gyro_x,gyro_y,gyro_z,accel_x,accel_y,accel_z\n");
+}
+
+static void capture_write(uint64_t time, uint8_t flags)
+{
+    const FrameAxes *a = &state.axes;
+    fprintf(capture, "%llu,%u,%u,", (unsigned long long)time, parser.sequence, flags);
+    // Active action codes separated by spaces.
+    bool first = true;
+    for (uint16_t i = 0; i < FRAME_ACTIONS_LEN; i++)
+    {
+        if (!frame_action_get(&state.digital, i))
+            continue;
+        fprintf(capture, first ? "%u" : " %u", i);
+        first = false;
+    }
+    fprintf(capture, ",");
+    fprintf(capture, "%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i,%i\n",
+        a->axes[0], a->axes[1], a->axes[2], a->axes[3], a->axes[4], a->axes[5],
+        state.mouse.x, state.mouse.y, state.mouse.scroll,
+        state.gyro.x, state.gyro.y, state.gyro.z,
+        state.accel.x, state.accel.y, state.accel.z);
+}
+
+static void gamepad_open()
+{
+    uinput = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (uinput < 0)
+    {
+        perror("uinput");
+        exit(1);
+    }
+    ioctl(uinput, UI_SET_EVBIT, EV_KEY);
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        if (gamepad_buttons[i])
+            ioctl(uinput, UI_SET_KEYBIT, gamepad_buttons[i]);
+    }
+    ioctl(uinput, UI_SET_EVBIT, EV_ABS);
+    for (uint8_t i = 0; i < FRAME_AXIS_LEN; i++)
+    {
+        bool trigger = (i == FRAME_AXIS_LZ || i == FRAME_AXIS_RZ);
+        struct uinput_abs_setup abs = {0};
+        abs.code = gamepad_axes[i];
+        abs.absinfo.minimum = trigger ? 0 : -FRAME_AXIS_SCALE;
+        abs.absinfo.maximum = FRAME_AXIS_SCALE;
+        ioctl(uinput, UI_SET_ABSBIT, gamepad_axes[i]);
+        ioctl(uinput, UI_ABS_SETUP, &abs);
+    }
+    struct uinput_setup setup = {0};
+    setup.id.bustype = BUS_VIRTUAL;
+    strcpy(setup.name, "Alpakka wireless receiver");
+    ioctl(uinput, UI_DEV_SETUP, &setup);
+    ioctl(uinput, UI_DEV_CREATE);
+}
+
+static void gamepad_emit(int type, int code, int value)
+{
+    struct input_event event = {0};
+    event.type = type;
+    event.code = code;
+    event.value = value;
+    if (write(uinput, &event, sizeof(event)) < 0 && errno != EAGAIN)
+        perror("uinput write");
+}
+
+static void gamepad_write()
+{
+    for (uint8_t i = 0; i < 16; i++)
+    {
+        if (gamepad_buttons[i])
+            gamepad_emit(EV_KEY, gamepad_buttons[i], frame_action_get(&state.digital, GAMEPAD_INDEX + i));
+    }
+    for (uint8_t i = 0; i < FRAME_AXIS_LEN; i++)
+    {
+        gamepad_emit(EV_ABS, gamepad_axes[i], state.axes.axes[i]);
+    }
+    gamepad_emit(EV_SYN, SYN_REPORT, 0);
+}
+
+static void gamepad_close()
+{
+    ioctl(uinput, UI_DEV_DESTROY);
+    close(uinput);
+}
+
+// ============================================================================
+// Statistics.
+
+static void stats_frame(const Options *options, const Frame *frame)
+{
+    uint64_t arrival = now_us();
+    stats.frames += 1;
+    if (!frame->header.flags)
+        stats.heartbeats += 1;
+    if (frame->header.flags & FRAME_FLAG_MOTION)
+        stats.samples += frame->motion.len;
+    if (stats.link_lost)
+    {
+        printf("Link recovered after %.0f ms\n", (arrival - stats.last_arrival) / 1000.0);
+        stats.link_lost = false;
+    }
+    if (stats.last_arrival)
+    {
+        double interval = (arrival - stats.last_arrival) / 1000.0;
+        double delta = fabs(interval - stats.last_interval);
+        stats.jitter += (delta - stats.jitter) / JITTER_SMOOTH;
+        stats.last_interval = interval;
+        stats.interval_sum += interval;
+        if (stats.intervals == 0 || interval < stats.interval_min)
+            stats.interval_min = interval;
+        if (interval > stats.interval_max)
+            stats.interval_max = interval;
+        stats.intervals += 1;
+    }
+    stats.last_arrival = arrival;
+    if (options->verbose)
+    {
+        printf("seq=%-5u len=%-2u flags=0x%02X interval=%.2f ms\n",
+            parser.sequence,
+            frame_size(frame),
+            frame->header.flags,
+            stats.last_interval);
+    }
+    if (capture)
+        capture_write(arrival, frame->header.flags);
+    if (uinput >= 0)
+        gamepad_write();
+}
+
+// A press and its release that are both new in the same frame, means the
+// frames that carried them were lost (or arrived together), and the tap is
+// recovered from the history.
+static void stats_history(const Options *options, const Frame *frame)
+{
+    FrameTransition transitions[FRAME_HISTORY_LEN];
+    uint8_t len = frame_history_new(
+        &frame->history,
+        &history_has_sequence,
+        &history_sequence,
+        transitions);
+    for (uint8_t i = 0; i < len; i++)
+    {
+        if (!transitions[i].pressed)
+            continue;
+        for (uint8_t j = i + 1; j < len; j++)
+        {
+            if (transitions[j].action == transitions[i].action && !transitions[j].pressed)
+            {
+                stats.recovered += 1;
+                if (options->verbose)
+                    printf("recovered tap action=%u\n", transitions[i].action);
+                break;
+            }
+        }
+    }
+}
+
+// ============================================================================
+// Latency.
+
+static void sync_request(int fd, const struct sockaddr_in *peer)
+{
+    Frame frame = {0};
+    frame.header.flags = FRAME_FLAG_SYNC;
+    frame.header.time = (uint32_t)now_us();
+    frame.sync.request = frame.header.time;
+    uint8_t buffer[FRAME_PACKED_MAX_SIZE];
+    uint8_t len = frame_pack(buffer, sync_sequence++, &frame);
+    if (peer)
+        sendto(fd, buffer, len, 0, (struct sockaddr *)peer, sizeof(*peer));
+    else
+        send(fd, buffer, len, MSG_NOSIGNAL);
+}
+
+static void latency_bin_add(Latency *latency, int32_t value)
+{
+    if (value < 0)
+        value = 0;
+    uint32_t bin = value / LATENCY_BIN;
+    if (bin >= LATENCY_BINS)
+        bin = LATENCY_BINS - 1;
+    latency->bins[bin] += 1;
+    latency->count += 1;
+}
+
+static void latency_add(const Options *options, const Frame *frame, uint64_t arrival)
+{
+    if (!clock_sync.synced || !(frame->header.flags & (FRAME_FLAGS_STATE | FRAME_FLAG_MOTION)))
+        return;
+    uint32_t capture = frame_clock_to_local(&clock_sync, frame->header.time);
+    int32_t latency = (uint32_t)arrival - capture;
+    for (uint8_t i = 0; i < LATENCIES_LEN; i++)
+    {
+        if (!(frame->header.flags & latencies[i].flag))
+            continue;
+        if (latencies[i].flag != FRAME_FLAG_MOTION)
+        {
+            latency_bin_add(&latencies[i], latency);
+            continue;
+        }
+        for (uint8_t j = 0; j < frame->motion.len; j++)
+            latency_bin_add(&latencies[i], latency + frame->motion.samples[j].age);
+    }
+    if (options->verbose)
+        printf("latency=%.2f ms\n", latency / 1000.0);
+}
+
+// Upper edge of the bin where the given fraction of the samples is reached.
+static double latency_percentile(const Latency *latency, double fraction)
+{
+    uint32_t target = latency->count * fraction;
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < LATENCY_BINS; i++)
+    {
+        sum += latency->bins[i];
+        if (sum > target)
+            return (i + 1) * LATENCY_BIN / 1000.0;
+    }
+    return LATENCY_BINS * LATENCY_BIN / 1000.0;
+}
+
+static void latency_report()
+{
+    for (uint8_t i = 0; i < LATENCIES_LEN; i++)
+    {
+        const Latency *latency = &latencies[i];
+        if (!latency->count)
+            continue;
+        printf("Latency %s: %u frames, p50=%.2f p90=%.2f p99=%.2f ms\n",
+            latency->name,
+            latency->count,
+            latency_percentile(latency, 0.5),
+            latency_percentile(latency, 0.9),
+            latency_percentile(latency, 0.99));
+        for (uint32_t bin = 0; bin < LATENCY_BINS; bin++)
+        {
+            if (!latency->bins[bin])
+                continue;
+            printf("  %6.2f ms %7u %5.1f%%\n",
+                bin * LATENCY_BIN / 1000.0,
+                latency->bins[bin],
+                latency->bins[bin] * 100.0 / latency->count);
+        }
+    }
+}
+
+static void stats_report()
+{
+    FrameParserStats *p = &parser.stats;
+    double average = stats.intervals ? stats.interval_sum / stats.intervals : 0;
+    printf(
+        "frames=%u/s heartbeats=%u/s imu=%u/s bytes=%u/s interval avg=%.2f min=%.2f max=%.2f ms "
+        "jitter=%.2f ms | total frames=%u lost=%u reordered=%u crc=%u "
+        "format=%u skipped=%u recovered=%u\n",
+        stats.frames, stats.heartbeats, stats.samples, stats.bytes,
+        average, stats.interval_min, stats.interval_max, stats.jitter,
+        p->frames, p->lost, p->reordered, p->crc_errors,
+        p->format_errors, p->skipped, stats.recovered);
+    if (clock_sync.synced)
+    {
+        printf("clock rtt=%u us drift=%.1f ppm\n",
+            clock_sync.best.rtt,
+            clock_sync.drift * 1000000);
+    }
+    fflush(stdout);
+    stats.frames = 0;
+    stats.heartbeats = 0;
+    stats.samples = 0;
+    stats.bytes = 0;
+    stats.interval_sum = 0;
+    stats.interval_min = 0;
+    stats.interval_max = 0;
+    stats.intervals = 0;
+}
+
+static void feed(const Options *options, const uint8_t *data, ssize_t len)
+{
+    stats.bytes += len;
+    for (ssize_t i = 0; i < len; i++)
+    {
+        Frame frame;
+        if (frame_parser_feed(&parser, data[i], &frame))
+        {
+            if (frame.header.flags & FRAME_FLAG_SYNC)
+                frame_clock_sample(&clock_sync, &frame.sync, (uint32_t)now_us());
+            latency_add(options, &frame, now_us());
+            frame_merge(&state, &frame);
+            if ((frame.header.flags & FRAME_FLAG_MOTION) && frame.motion.len)
+            {
+                // The state keeps the newest IMU sample.
+                state.gyro = frame.motion.samples[frame.motion.len - 1].gyro;
+                state.accel = frame.motion.samples[frame.motion.len - 1].accel;
+            }
+            stats_frame(options, &frame);
+            if (frame.header.flags & FRAME_FLAG_HISTORY)
+                stats_history(options, &frame);
+        }
+    }
+}
+
+// ============================================================================
+// Transport.
+
+static int socket_open(const Options *options)
+{
+    int fd = socket(AF_INET, options->udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        exit(1);
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    // Wake up periodically to print statistics even without traffic.
+    struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    struct sockaddr_in address = {0};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(options->port);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror("bind");
+        exit(1);
+    }
+    if (!options->udp && listen(fd, 1) < 0)
+    {
+        perror("listen");
+        exit(1);
+    }
+    printf("Listening on %s port %u\n", options->udp ? "UDP" : "TCP", options->port);
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    Options options = parse_options(argc, argv);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    frame_parser_init(&parser);
+    if (options.capture)
+        capture_open(options.capture);
+    if (options.gamepad)
+        gamepad_open();
+    int server = socket_open(&options);
+    int client = options.udp ? server : -1;
+    uint64_t last_report = now_us();
+    uint64_t last_sync = 0;
+    struct sockaddr_in peer = {0};
+    bool has_peer = false;
+    uint8_t data[2048];
+    while (running)
+    {
+        if (client < 0)
+        {
+            socklen_t peer_len = sizeof(peer);
+            client = accept(server, (struct sockaddr *)&peer, &peer_len);
+            if (client >= 0)
+            {
+                printf("Connected %s\n", inet_ntoa(peer.sin_addr));
+                struct timeval timeout = {.tv_sec = 0, .tv_usec = 100000};
+                setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            }
+        }
+        else
+        {
+            struct sockaddr_in source;
+            socklen_t source_len = sizeof(source);
+            ssize_t len = recvfrom(client, data, sizeof(data), 0, (struct sockaddr *)&source, &source_len);
+            if (len > 0 && options.udp)
+            {
+                // Answers go to wherever the controller sends from.
+                peer = source;
+                has_peer = true;
+            }
+            if (len > 0)
+            {
+                feed(&options, data, len);
+            }
+            else if (len == 0 && !options.udp)
+            {
+                printf("Disconnected\n");
+                close(client);
+                client = -1;
+                stats.last_arrival = 0;
+                stats.link_lost = false;
+                history_has_sequence = false;
+                clock_sync = (FrameClock){0};
+            }
+        }
+        if (stats.last_arrival && !stats.link_lost &&
+            now_us() - stats.last_arrival >= LINK_LOST_TIMEOUT * 1000)
+        {
+            printf("Link lost\n");
+            stats.link_lost = true;
+        }
+        if (client >= 0 && (!options.udp || has_peer) && now_us() - last_sync >= SYNC_INTERVAL)
+        {
+            sync_request(client, options.udp ? &peer : NULL);
+            last_sync = now_us();
+        }
+        if (now_us() - last_report >= 1000000)
+        {
+            stats_report();
+            last_report = now_us();
+        }
+    }
+    latency_report();
+    if (client >= 0 && client != server)
+        close(client);
+    close(server);
+    if (capture)
+        fclose(capture);
+    if (uinput >= 0)
+        gamepad_close();
+    return 0;
+}